@@ -80,17 +80,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct   if (!decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_not_direct if (!decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct
-#define UNLOCK_O_not_direct
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -346,8 +338,10 @@ static decode_state alac_decode(void) {
 			LOCK_O;
 
 			output.next_sample_rate = decode_newstream(l->sample_rate, output.supported_rates);
+			// lossless so bounded by the pcm bitrate, which may be well above the nominal one for high resolution streams
+			stream_bitrate(l->sample_rate * l->channels * l->sample_size / 1000);
 			IF_DSD( output.next_fmt = PCM; )
-			output.track_start = outputbuf->writep;
+			_output_track_start(outputbuf->writep);
 			if (output.fade_mode) _checkfade(true);
 			decode.new_stream = false;
 
@@ -455,8 +449,6 @@ static decode_state alac_decode(void) {
 		l->samples -= frames;
 	}
 
-	LOCK_O_direct;
-
 	while (frames > 0) {
 		size_t f, count;
 		ISAMPLE_T *optr;
@@ -514,8 +506,6 @@ static decode_state alac_decode(void) {
 		);
 	 }
 
-	UNLOCK_O_direct;
-
 	return DECODE_RUNNING;
 }
 
@@ -541,6 +531,7 @@ struct codec *register_alac(void) {
 		alac_open,      // open
 		alac_close,     // close
 		alac_decode,    // decode
+		1411,           // bitrate kbps
 	};
 	
 	l =  calloc(1, sizeof(struct alac));
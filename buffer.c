@@ -25,76 +25,422 @@
 
 #include "squeezelite.h"
 
+#if LINUX && !SUN
+#include <sys/mman.h>
+#include <fcntl.h>
+#define MMAP_BUF 1
+#else
+#define MMAP_BUF 0
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define DROP_BEHIND    (1024 * 1024) // release consumed file backed pages in chunks of this size
+
+// set from command line: buffers are mirrored, or backed by explicit huge pages, when created if possible
+bool buf_mirror = false;
+bool buf_huge = false;
+
+#if MMAP_BUF
+// map the same memfd twice back to back so any read or write of up to size bytes from within the buffer is contiguous
+static u8_t *_mirror_alloc(size_t size) {
+	u8_t *p, *m;
+	int fd = memfd_create("squeezelite", MFD_CLOEXEC);
+
+	if (fd < 0) {
+		return NULL;
+	}
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	// reserve address space for both copies then map the file over each half
+	p = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	m = mmap(p, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	if (m != MAP_FAILED) {
+		m = mmap(p + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	}
+
+	// mappings hold a reference to the file
+	close(fd);
+
+	if (m == MAP_FAILED) {
+		munmap(p, 2 * size);
+		return NULL;
+	}
+
+	return p;
+}
+#endif
+
+// allocate memory touched by the realtime output path: an anonymous mapping using explicit huge pages if requested,
+// otherwise advised for transparent huge pages, prefaulted and locked individually rather than locking the whole process
+// size is rounded up to the page size used, falls back to malloc if mapping is not possible, mem reports what was done
+u8_t *buf_mem_alloc(size_t *size, u8_t *mem) {
+	u8_t *p = NULL;
+	*mem = 0;
+#if MMAP_BUF
+	{
+		size_t len = (*size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void *m = MAP_FAILED;
+
+		if (buf_huge && *size >= HUGE_PAGE_SIZE) {
+			m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (m != MAP_FAILED) {
+				*mem |= BUF_HUGE;
+			}
+		}
+		if (m == MAP_FAILED) {
+			size_t page = sysconf(_SC_PAGESIZE);
+			len = (*size + page - 1) / page * page;
+			m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (m != MAP_FAILED && len >= HUGE_PAGE_SIZE && madvise(m, len, MADV_HUGEPAGE) == 0) {
+				*mem |= BUF_THP;
+			}
+		}
+		if (m != MAP_FAILED) {
+			p = m;
+			*size = len;
+			*mem |= BUF_MMAP;
+			// mlock faults in all pages
+			if (mlock(p, len) == 0) {
+				*mem |= BUF_LOCKED;
+			}
+		}
+	}
+#endif
+	if (!p) {
+		p = malloc(*size);
+	}
+#if LINUX || FREEBSD
+	if (p && !(*mem & BUF_LOCKED)) {
+		touch_memory(p, *size);
+	}
+#endif
+	return p;
+}
+
+void buf_mem_free(u8_t *p, size_t size, u8_t mem) {
+#if MMAP_BUF
+	if (mem & BUF_MMAP) {
+		munmap(p, size);
+		return;
+	}
+#endif
+	free(p);
+}
+
+// return the pages of an idle allocation to the system, the mapping is kept so they are faulted back in place by
+// buf_mem_reacquire and read back as zeros, returns the bytes released, 0 if not mapped or they can't be discarded
+size_t buf_mem_release(u8_t *p, size_t size, u8_t *mem) {
+#if MMAP_BUF
+	if ((*mem & (BUF_MMAP | BUF_RELEASED)) == BUF_MMAP) {
+		size_t len = *mem & BUF_MIRROR ? 2 * size : size;
+		// locked pages can't be discarded, mirrored buffers share a memfd so its pages are removed from the file
+		if (*mem & BUF_LOCKED) {
+			munlock(p, len);
+		}
+		if (madvise(p, size, *mem & BUF_MIRROR ? MADV_REMOVE : MADV_DONTNEED) == 0) {
+			*mem |= BUF_RELEASED;
+			return size;
+		}
+		if (*mem & BUF_LOCKED && mlock(p, len) != 0) {
+			*mem &= ~BUF_LOCKED;
+		}
+	}
+#endif
+	return 0;
+}
+
+// fault back in, and lock again if it was locked, memory released by buf_mem_release before it is next used
+void buf_mem_reacquire(u8_t *p, size_t size, u8_t *mem) {
+#if MMAP_BUF
+	if (*mem & BUF_RELEASED) {
+		*mem &= ~BUF_RELEASED;
+		// file backed and paged memory is faulted in as it is used
+		if (*mem & (BUF_FILE | BUF_PAGED)) {
+			return;
+		}
+		if (*mem & BUF_LOCKED && mlock(p, *mem & BUF_MIRROR ? 2 * size : size) == 0) {
+			return;
+		}
+		*mem &= ~BUF_LOCKED;
+		touch_memory(p, size);
+	}
+#endif
+}
+
+#if MMAP_BUF
+// map a file created in dir on local storage, unlinked once created so it is removed when the buffer is freed
+// blocks are allocated up front so writes to the mapping can't fail (and raise SIGBUS) when the device fills
+static u8_t *_file_alloc(const char *dir, size_t size, int *fd) {
+	char path[PATH_MAX];
+	void *p;
+
+	snprintf(path, sizeof(path), "%s/squeezelite-XXXXXX", dir);
+	*fd = mkostemp(path, O_CLOEXEC);
+	if (*fd < 0) {
+		return NULL;
+	}
+	unlink(path);
+
+	if (posix_fallocate(*fd, 0, size) != 0) {
+		close(*fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (p == MAP_FAILED) {
+		close(*fd);
+		return NULL;
+	}
+
+	// written once and read once in order, so read ahead aggressively and don't keep pages around
+	madvise(p, size, MADV_SEQUENTIAL);
+
+	return p;
+}
+
+// release pages the consumer has finished with from the mapping and page cache so they don't accumulate
+// called by the consumer only, dropp always advances in whole pages from the page aligned start of the buffer
+static void _buf_drop_behind(struct buffer *buf) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	u8_t *readp = buf->readp;
+	size_t done = readp >= buf->dropp ? readp - buf->dropp : buf->size - (buf->dropp - readp);
+
+	while (done >= DROP_BEHIND) {
+		size_t len = min(done, (size_t)(buf->wrap - buf->dropp)) / page * page;
+		if (len) {
+			madvise(buf->dropp, len, MADV_DONTNEED);
+			posix_fadvise(buf->fd, buf->dropp - buf->buf, len, POSIX_FADV_DONTNEED);
+		} else {
+			// less than a page before wrap, which is not page aligned after buf_adjust
+			len = buf->wrap - buf->dropp;
+		}
+		buf->dropp += len;
+		if (buf->dropp >= buf->wrap) {
+			buf->dropp = buf->buf;
+		}
+		done -= min(done, len);
+	}
+}
+#endif
+
+// allocate ring memory, mapped buffers must be a whole number of pages so size may be rounded up
+// file backed and paged buffers are not mirrored, locked or prefaulted as they are intended to be larger than memory
+static size_t _buf_alloc(struct buffer *buf, size_t size) {
+#if MMAP_BUF
+	if (buf->paged) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t psize = (size + page - 1) / page * page;
+		void *p = mmap(NULL, psize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED) {
+			// released a block at a time so huge pages would only be split
+			madvise(p, psize, MADV_NOHUGEPAGE);
+			buf->buf = p;
+			buf->mem = BUF_PAGED | BUF_MMAP;
+			return psize;
+		}
+	}
+	if (buf->dir) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t fsize = (size + page - 1) / page * page;
+		buf->buf = _file_alloc(buf->dir, fsize, &buf->fd);
+		if (buf->buf) {
+			buf->mem = BUF_FILE | BUF_MMAP;
+			buf->dropp = buf->buf;
+			return fsize;
+		}
+	}
+	if (buf_mirror) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t msize = (size + page - 1) / page * page;
+		buf->buf = _mirror_alloc(msize);
+		if (buf->buf) {
+			buf->mem = BUF_MIRROR | BUF_MMAP;
+			if (mlock(buf->buf, 2 * msize) == 0) {
+				buf->mem |= BUF_LOCKED;
+			} else {
+				touch_memory(buf->buf, msize);
+			}
+			return msize;
+		}
+	}
+#endif
+	buf->buf = buf_mem_alloc(&size, &buf->mem);
+	return buf->buf ? size : 0;
+}
+
+static void _buf_free(struct buffer *buf) {
+#if MMAP_BUF
+	if (buf->mem & BUF_FILE) {
+		close(buf->fd);
+	}
+#endif
+	if (buf->mem & BUF_MIRROR) {
+		buf_mem_free(buf->buf, 2 * buf->size, buf->mem);
+	} else {
+		buf_mem_free(buf->buf, buf->size, buf->mem);
+	}
+	buf->buf = NULL;
+}
+
 // _* called with muxtex locked
+// the index functions may also be called without the mutex by the single producer (writep) or consumer (readp)
+// indices of the other side are loaded with acquire so data written before the index was published is visible
 
 #if !WIN
 inline
 #endif
 unsigned _buf_used(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->size - (buf->readp - buf->writep);
+	u8_t *readp  = load_acquire(buf->readp);
+	u8_t *writep = load_acquire(buf->writep);
+	return writep >= readp ? writep - readp : buf->size - (readp - writep);
 }
 
 unsigned _buf_space(struct buffer *buf) {
 	return buf->size - _buf_used(buf) - 1; // reduce by one as full same as empty otherwise
 }
 
+// mirrored buffers are contiguous past wrap so all used or free space can be accessed in one go
 unsigned _buf_cont_read(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->wrap - buf->readp;
+	u8_t *readp, *writep;
+	if (buf->mem & BUF_MIRROR) {
+		return _buf_used(buf);
+	}
+	readp  = load_acquire(buf->readp);
+	writep = load_acquire(buf->writep);
+	return writep >= readp ? writep - readp : buf->wrap - readp;
 }
 
 unsigned _buf_cont_write(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->wrap - buf->writep : buf->readp - buf->writep;
+	u8_t *readp, *writep;
+	if (buf->mem & BUF_MIRROR) {
+		return _buf_space(buf);
+	}
+	readp  = load_acquire(buf->readp);
+	writep = load_acquire(buf->writep);
+	return writep >= readp ? buf->wrap - writep : readp - writep;
 }
 
+// publish with release so the other side only sees the new index after the data it covers
 void _buf_inc_readp(struct buffer *buf, unsigned by) {
-	buf->readp += by;
-	if (buf->readp >= buf->wrap) {
-		buf->readp -= buf->size;
+	u8_t *readp = buf->readp + by;
+	if (readp >= buf->wrap) {
+		readp -= buf->size;
+	}
+	store_release(buf->readp, readp);
+#if MMAP_BUF
+	if (buf->mem & BUF_FILE) {
+		_buf_drop_behind(buf);
 	}
+#endif
+}
+
+// move readp back over data already read, the caller ensures this has not been overwritten
+void _buf_dec_readp(struct buffer *buf, unsigned by) {
+	u8_t *readp = buf->readp - by;
+	if (readp < buf->buf) {
+		readp += buf->size;
+	}
+	store_release(buf->readp, readp);
 }
 
 void _buf_inc_writep(struct buffer *buf, unsigned by) {
-	buf->writep += by;
-	if (buf->writep >= buf->wrap) {
-		buf->writep -= buf->size;
+	u8_t *writep = buf->writep + by;
+	if (writep >= buf->wrap) {
+		writep -= buf->size;
 	}
+	store_release(buf->writep, writep);
 }
 
 void buf_flush(struct buffer *buf) {
 	mutex_lock(buf->mutex);
-	buf->readp  = buf->buf;
-	buf->writep = buf->buf;
+	store_release(buf->readp, buf->buf);
+	store_release(buf->writep, buf->buf);
+#if MMAP_BUF
+	if (buf->mem & BUF_FILE) {
+		// contents no longer needed
+		madvise(buf->buf, buf->size, MADV_DONTNEED);
+		posix_fadvise(buf->fd, 0, 0, POSIX_FADV_DONTNEED);
+		buf->dropp = buf->buf;
+	}
+#endif
 	mutex_unlock(buf->mutex);
 }
 
+// called with mutex locked while the buffer is idle, discards the contents and releases its memory to the system until
+// _buf_reacquire, returns the bytes released
+size_t _buf_release(struct buffer *buf) {
+	size_t size;
+	store_release(buf->readp, buf->buf);
+	store_release(buf->writep, buf->buf);
+	size = buf_mem_release(buf->buf, buf->base_size, &buf->mem);
+#if MMAP_BUF
+	if (size && buf->mem & BUF_FILE) {
+		posix_fadvise(buf->fd, 0, 0, POSIX_FADV_DONTNEED);
+		buf->dropp = buf->buf;
+	}
+#endif
+	return size;
+}
+
+// called with mutex locked before a buffer released by _buf_release is used again
+void _buf_reacquire(struct buffer *buf) {
+	buf_mem_reacquire(buf->buf, buf->base_size, &buf->mem);
+}
+
 // adjust buffer to multiple of mod bytes so reading in multiple always wraps on frame boundary
+// not needed for mirrored buffers as reads never split at wrap, which keeps the mapping size
 void buf_adjust(struct buffer *buf, size_t mod) {
 	size_t size;
 	mutex_lock(buf->mutex);
-	size = ((unsigned)(buf->base_size / mod)) * mod;
+	size = buf->mem & BUF_MIRROR ? buf->base_size : ((unsigned)(buf->base_size / mod)) * mod;
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
 	buf->wrap   = buf->buf + size;
 	buf->size   = size;
+	buf->dropp  = buf->buf;
 	mutex_unlock(buf->mutex);
 }
 
-// called with mutex locked to resize, does not retain contents, reverts to original size if fails
-void _buf_resize(struct buffer *buf, size_t size) {
-	free(buf->buf);
-	buf->buf = malloc(size);
+// called with mutex locked to resize, retains contents which are moved to the start of the new buffer
+// leaves the buffer unchanged and returns false if the contents do not fit or the new size can't be allocated
+bool _buf_resize(struct buffer *buf, size_t size) {
+	struct buffer old = *buf;
+	size_t used = _buf_used(buf);
+	size_t cont = min(used, (size_t)(buf->wrap - buf->readp));
+
+	if (size <= used) {
+		return false;
+	}
+
+	size = _buf_alloc(buf, size);
 	if (!buf->buf) {
-		size    = buf->size;
-		buf->buf= malloc(size);
-		if (!buf->buf) {
-			size = 0;
-		}
+		buf->buf = old.buf;
+		buf->mem = old.mem;
+		buf->fd  = old.fd;
+		buf->dropp = old.dropp;
+		return false;
 	}
+
+	memcpy(buf->buf, old.readp, cont);
+	memcpy(buf->buf + cont, old.buf, used - cont);
+
+	_buf_free(&old);
+
 	buf->readp  = buf->buf;
-	buf->writep = buf->buf;
+	buf->writep = buf->buf + used;
 	buf->wrap   = buf->buf + size;
 	buf->size   = size;
 	buf->base_size = size;
+
+	return true;
 }
 
 void _buf_unwrap(struct buffer *buf, size_t cont) {
@@ -102,8 +448,8 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 	size_t size;
 	u8_t *scratch;
 
-	// do nothing if we have enough space
-	if (by <= 0 || cont >= buf->size) return;
+	// do nothing if we have enough space or reads are always contiguous
+	if (by <= 0 || cont >= buf->size || buf->mem & BUF_MIRROR) return;
 
 	// buffer already unwrapped, just move it up
 	if (buf->writep >= buf->readp) {
@@ -148,7 +494,13 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 }
 
 void buf_init(struct buffer *buf, size_t size) {
-	buf->buf    = malloc(size);
+	buf_init_file(buf, size, NULL);
+}
+
+// as buf_init but backed by a file in dir if possible, dir must remain valid for resizing
+void buf_init_file(struct buffer *buf, size_t size, const char *dir) {
+	buf->dir = dir;
+	size = _buf_alloc(buf, size);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
 	buf->wrap   = buf->buf + size;
@@ -157,10 +509,16 @@ void buf_init(struct buffer *buf, size_t size) {
 	mutex_create_p(buf->mutex);
 }
 
+// as buf_init but pages are only allocated when touched, for an owner which releases them with MADV_DONTNEED
+// check for BUF_PAGED in mem as this falls back to a normal allocation
+void buf_init_paged(struct buffer *buf, size_t size) {
+	buf->paged = true;
+	buf_init_file(buf, size, NULL);
+}
+
 void buf_destroy(struct buffer *buf) {
 	if (buf->buf) {
-		free(buf->buf);
-		buf->buf = NULL;
+		_buf_free(buf);
 		buf->size = 0;
 		buf->base_size = 0;
 		mutex_destroy(buf->mutex);
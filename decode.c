@@ -54,6 +54,12 @@ static bool running = true;
 #endif
 
 static void *decode_thread(void *vargp) {
+#if LINUX && !SUN
+	void *stack;
+	size_t stack_size;
+	bool stack_locked = lock_thread_stack(&stack, &stack_size);
+	LOG_INFO("decode thread stack: %u bytes at %p%s", stack_size, stack, stack_locked ? " locked" : " not locked");
+#endif
 
 	while (running) {
 		size_t bytes, space, min_space;
@@ -64,9 +70,7 @@ static void *decode_thread(void *vargp) {
 		bytes = _buf_used(streambuf);
 		toend = (stream.state <= DISCONNECT);
 		UNLOCK_S;
-		LOCK_O;
-		space = _buf_space(outputbuf);
-		UNLOCK_O;
+		space = output_space(); // lock free as decode is the only producer for outputbuf, unless resizing
 
 		LOCK_D;
 
@@ -82,6 +86,18 @@ static void *decode_thread(void *vargp) {
 			);
 			
 			if (space > min_space && (bytes > codec->min_read_bytes || toend)) {
+
+				u8_t *writep = outputbuf->writep;
+				u8_t width = output.next_frame_bytes;
+
+#if BYTES_PER_FRAME == 8
+				// a track following narrow frames may start part way through a full width frame and so straddle the
+				// end of outputbuf, pad the previous track with a silent narrow frame so the new track starts aligned
+				if (decode.new_stream && (outputbuf->writep - outputbuf->buf) % BYTES_PER_FRAME) {
+					memset(outputbuf->writep, 0, NARROW_BYTES_PER_FRAME);
+					_buf_inc_writep(outputbuf, NARROW_BYTES_PER_FRAME);
+				}
+#endif
 				
 				decode.state = codec->decode();
 
@@ -95,12 +111,15 @@ static void *decode_thread(void *vargp) {
 					}
 				);
 
+				zbuf_written(writep, width);
+
 				if (decode.state != DECODE_RUNNING) {
 
 					LOG_INFO("decode %s", decode.state == DECODE_COMPLETE ? "complete" : "error");
 
 					LOCK_O;
 					if (output.fade_mode) _checkfade(false);
+					_output_seal();
 					UNLOCK_O;
 
 					wake_controller();
@@ -109,6 +128,8 @@ static void *decode_thread(void *vargp) {
 				ran = true;
 			}
 		}
+
+		zbuf_pack();
 		
 		UNLOCK_D;
 
@@ -254,15 +275,23 @@ unsigned decode_newstream(unsigned sample_rate, unsigned supported_rates[]) {
 
 	// called with O locked to get sample rate for potentially processed output stream
 	// release O mutex during process_newstream as it can take some time
+	// crossfades mix at the rate of the previous track so the new track is resampled to it if processing, only where
+	// the previous track is still buffered to be faded from
 
 	MAY_PROCESS(
 		if (decode.process) {
+			unsigned cross_rate = output.fade_mode == FADE_CROSSFADE && output.fade_secs && _buf_used(outputbuf) ?
+				output.next_sample_rate : 0;
 			UNLOCK_O;
-			sample_rate = process_newstream(&decode.direct, sample_rate, supported_rates);
+			sample_rate = process_newstream(&decode.direct, sample_rate, supported_rates, cross_rate);
 			LOCK_O;
 		}
 	);
 
+	// codecs which can store narrow frames select this via decode_frame_bytes after decode_newstream
+	output.prev_frame_bytes = output.next_frame_bytes;
+	output.next_frame_bytes = BYTES_PER_FRAME;
+
 	// reduce threshold if we don't have enough room in outputbuf
 	if (output.threshold * sample_rate / 10 > outputbuf->size / BYTES_PER_FRAME / 2) {
 		output.threshold = (outputbuf->size / BYTES_PER_FRAME / 2 * 10) / sample_rate;
@@ -272,6 +301,33 @@ unsigned decode_newstream(unsigned sample_rate, unsigned supported_rates[]) {
 	return sample_rate;
 }
 
+u8_t decode_frame_bytes(unsigned sample_bits) {
+
+	// called with O locked after decode_newstream to select the width frames of the new track are stored in outputbuf
+	// 16 bit sources are stored as 16 bit frames if the output can play them, halving outputbuf memory and bandwidth
+	// not used when processing or for dsd/dop as these operate on full width frames, crossfades mix frames of either width
+
+#if BYTES_PER_FRAME == 8
+	bool narrow = sample_bits <= 16 && output.narrow;
+
+	IF_PROCESS(
+		narrow = false;
+	);
+	IF_DSD(
+		if (output.next_fmt != PCM) {
+			narrow = false;
+		}
+	);
+
+	if (narrow) {
+		output.next_frame_bytes = NARROW_BYTES_PER_FRAME;
+		LOG_INFO("storing %u bit frames in outputbuf as %u bytes", sample_bits, NARROW_BYTES_PER_FRAME);
+	}
+#endif
+
+	return output.next_frame_bytes;
+}
+
 void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness) {
 	int i;
 
@@ -297,6 +353,9 @@ void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels,
 			}
 			
 			codec = codecs[i];
+
+			// sized at the nominal bitrate unless the codec sets it from the stream's parameters
+			stream_bitrate(codec->bitrate);
 			
 			codec->open(sample_size, sample_rate, channels, endianness);
 
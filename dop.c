@@ -84,4 +84,14 @@ void update_dop(u32_t *ptr, frames_t frames, bool invert) {
 	}
 }
 
+// invert polarity for frames in the output buffer
+void dsd_invert(u32_t *ptr, frames_t frames) {
+	while (frames--) {
+		*ptr = ~(*ptr);
+		++ptr;
+		*ptr = ~(*ptr);
+		++ptr;
+	}
+}
+
 #endif // DSD
@@ -42,17 +42,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct   if (!decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_not_direct if (!decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct
-#define UNLOCK_O_not_direct
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -766,7 +758,7 @@ static decode_state dsd_decode(void) {
 		LOCK_O;
 
 		LOG_INFO("setting track_start");
-		output.track_start = outputbuf->writep;
+		_output_track_start(outputbuf->writep);
 
 		outfmt = output.dsdfmt;
 
@@ -819,6 +811,7 @@ static decode_state dsd_decode(void) {
 			if (output.fade_mode) _checkfade(true);
 		} else {
 			LOG_INFO("DSD%u stream, format: %s, rate: %uHz\n", d->sample_rate / 44100, fmtstr, output.next_sample_rate);
+			output.next_frame_bytes = BYTES_PER_FRAME;
 			output.fade = FADE_INACTIVE;
 		}
 
@@ -828,8 +821,6 @@ static decode_state dsd_decode(void) {
 		UNLOCK_O;
 	}
 
-	LOCK_O_direct;
-
 	switch (d->type) {
 	case DSF:
 		ret = _decode_dsf();
@@ -841,7 +832,6 @@ static decode_state dsd_decode(void) {
 		ret = DECODE_ERROR;
 	}
 
-	UNLOCK_O_direct;
 	UNLOCK_S;
 
 	return ret;
@@ -894,6 +884,7 @@ struct codec *register_dsd(void) {
 		dsd_open,    // open
 		dsd_close,   // close
 		dsd_decode,  // decode
+		5645,        // bitrate kbps
 	};
 
 	d = malloc(sizeof(struct dsd));
@@ -909,16 +900,6 @@ struct codec *register_dsd(void) {
 	return &ret;
 }
 
-// invert polarity for frames in the output buffer
-void dsd_invert(u32_t *ptr, frames_t frames) {
-	while (frames--) {
-		*ptr = ~(*ptr);
-		++ptr;
-		*ptr = ~(*ptr);
-		++ptr;
-	}
-}
-
 // fill silence buffer with 10101100 which represents dsd silence
 void dsd_silence_frames(u32_t *ptr, frames_t frames) {
 	while (frames--) {
@@ -78,13 +78,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -390,7 +386,7 @@ static decode_state faad_decode(void) {
 			LOG_INFO("setting track_start");
 			output.next_sample_rate = decode_newstream(samplerate, output.supported_rates);
 			IF_DSD( output.next_fmt = PCM; )
-			output.track_start = outputbuf->writep;
+			_output_track_start(outputbuf->writep);
 			if (output.fade_mode) _checkfade(true);
 			decode.new_stream = false;
 			UNLOCK_O;
@@ -498,8 +494,6 @@ static decode_state faad_decode(void) {
 
 	LOG_SDEBUG("write %u frames", frames);
 
-	LOCK_O_direct;
-
 	while (frames > 0) {
 		frames_t f;
 		frames_t count;
@@ -547,8 +541,6 @@ static decode_state faad_decode(void) {
 		);
 	}
 
-	UNLOCK_O_direct;
-
 	return DECODE_RUNNING;
 }
 
@@ -645,6 +637,7 @@ struct codec *register_faad(void) {
 		faad_open,    // open
 		faad_close,   // close
 		faad_decode,  // decode
+		320,          // bitrate kbps
 	};
 
 	a = malloc(sizeof(struct faad));
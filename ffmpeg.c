@@ -107,13 +107,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -364,7 +360,7 @@ static decode_state ff_decode(void) {
 		LOG_INFO("setting track_start");
 		output.next_sample_rate = decode_newstream(ff->codecP->sample_rate, output.supported_rates);
 		IF_DSD(	output.next_fmt = PCM; )
-		output.track_start = outputbuf->writep;
+		_output_track_start(outputbuf->writep);
 		if (output.fade_mode) _checkfade(true);
 		decode.new_stream = false;
 		UNLOCK_O;
@@ -426,7 +422,6 @@ static decode_state ff_decode(void) {
 					   ff->codecC->sample_fmt);
 #endif
 			
-			LOCK_O_direct;
 
 			while (frames > 0) {
 				frames_t count;
@@ -538,7 +533,6 @@ static decode_state ff_decode(void) {
 				);
 			}
 			
-			UNLOCK_O_direct;
 		}
 	}
 
@@ -772,6 +766,7 @@ struct codec *register_ff(const char *codec) {
 			ff_open_wma, // open
 			ff_close,    // close
 			ff_decode,   // decode
+			768,         // bitrate kbps
 		};
 		
 		LOG_INFO("using ffmpeg to decode wma,wmap,wmal");
@@ -788,6 +783,7 @@ struct codec *register_ff(const char *codec) {
 			ff_open_alac,// open
 			ff_close,    // close
 			ff_decode,   // decode
+			1411,        // bitrate kbps
 		};
 		
 		LOG_INFO("using ffmpeg to decode alc");		
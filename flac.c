@@ -102,13 +102,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -169,12 +165,15 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 
 	FLAC__int32 *lptr = (FLAC__int32 *)buffer[0];
 	FLAC__int32 *rptr = (FLAC__int32 *)buffer[channels > 1 ? 1 : 0];
+	u8_t frame_bytes;
 	
 	if (decode.new_stream) {
 		LOCK_O;
 		LOG_INFO("setting track_start");
-		output.track_start = outputbuf->writep;
+		_output_track_start(outputbuf->writep);
 		decode.new_stream = false;
+		// lossless so bounded by the pcm bitrate, which may be well above the nominal one for high resolution streams
+		stream_bitrate(frame->header.sample_rate * channels * bits_per_sample / 1000);
 
 #if DSD
 #if SL_LITTLE_ENDIAN
@@ -189,21 +188,24 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 			else
 				output.next_fmt = DOP;
 			output.next_sample_rate = frame->header.sample_rate;
+			output.next_frame_bytes = BYTES_PER_FRAME;
 			output.fade = FADE_INACTIVE;
 		} else {
 			output.next_sample_rate = decode_newstream(frame->header.sample_rate, output.supported_rates);
 			output.next_fmt = PCM;
+			decode_frame_bytes(bits_per_sample);
 			if (output.fade_mode) _checkfade(true);
 		}
 #else
 		output.next_sample_rate = decode_newstream(frame->header.sample_rate, output.supported_rates);
+		decode_frame_bytes(bits_per_sample);
 		if (output.fade_mode) _checkfade(true);
 #endif
 
 		UNLOCK_O;
 	}
 
-	LOCK_O_direct;
+	frame_bytes = output.next_frame_bytes;
 
 	while (frames > 0) {
 		frames_t f;
@@ -212,7 +214,7 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 
 		IF_DIRECT( 
 			optr = (ISAMPLE_T *)outputbuf->writep; 
-			f = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME; 
+			f = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / frame_bytes; 
 		);
 		IF_PROCESS(
 			optr = (ISAMPLE_T *)process.inbuf;
@@ -223,7 +225,15 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 
 		count = f;
 
-		if (bits_per_sample == 8) {
+		if (frame_bytes != BYTES_PER_FRAME) {
+			// narrow 16 bit frames, only selected for sources of 16 bits or less
+			s16_t *nptr = (s16_t *)optr;
+			unsigned shift = 16 - bits_per_sample;
+			while (count--) {
+				*nptr++ = *lptr++ << shift;
+				*nptr++ = *rptr++ << shift;
+			}
+		} else if (bits_per_sample == 8) {
 			while (count--) {
 				*optr++ = ALIGN8(*lptr++);
 				*optr++ = ALIGN8(*rptr++);
@@ -250,7 +260,7 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		frames -= f;
 
 		IF_DIRECT(
-			_buf_inc_writep(outputbuf, f * BYTES_PER_FRAME);
+			_buf_inc_writep(outputbuf, f * frame_bytes);
 		);
 		IF_PROCESS(
 			process.in_frames = f;
@@ -258,8 +268,6 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		);
 	}
 
-	UNLOCK_O_direct;
-
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -373,6 +381,7 @@ struct codec *register_flac(void) {
 		flac_open,    // open
 		flac_close,   // close
 		flac_decode,  // decode
+		1411,         // bitrate kbps
 	};
 
 	f = malloc(sizeof(struct flac));
@@ -70,13 +70,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -247,14 +243,12 @@ static decode_state mad_decode(void) {
 			LOG_INFO("setting track_start");
 			output.next_sample_rate = decode_newstream(m->synth.pcm.samplerate, output.supported_rates);
 			IF_DSD(	output.next_fmt = PCM; )
-			output.track_start = outputbuf->writep;
+			_output_track_start(outputbuf->writep);
 			if (output.fade_mode) _checkfade(true);
 			decode.new_stream = false;
 			UNLOCK_O;
 		}
 
-		LOCK_O_direct;
-
 		IF_DIRECT(
 			max_frames = _buf_space(outputbuf) / BYTES_PER_FRAME;
 		);
@@ -331,7 +325,6 @@ static decode_state mad_decode(void) {
 			);
 		}
 
-		UNLOCK_O_direct;
 	}
 
 	return eos ? DECODE_COMPLETE : DECODE_RUNNING;
@@ -406,6 +399,7 @@ struct codec *register_mad(void) {
 		mad_open,     // open
 		mad_close,    // close
 		mad_decode,   // decode
+		320,          // bitrate kbps
 	};
 
 	m = calloc(1, sizeof(struct mad));
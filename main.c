@@ -68,7 +68,7 @@ static void usage(const char *argv0) {
 		   "  -o <output device>\tSpecify output device, default \"default\", - = output to stdout\n"
 		   "  -l \t\t\tList output devices\n"
 #if ALSA
-		   "  -a <b>:<p>:<f>:<m>\tSpecify ALSA params to open output device, b = buffer time in ms or size in bytes, p = period count or size in bytes, f sample format (16|24|24_3|32), m = use mmap (0|1)\n"
+		   "  -a <b>:<p>:<f>:<m>:<d>:<t>\tSpecify ALSA params to open output device, b = buffer time in ms or size in bytes, p = period count or size in bytes, f sample format (16|24|24_3|32|float), m = use mmap (0|1), d = open device twice (0|1), t = refill on a timer t ms before the buffer empties, b is then always in ms\n"
 #endif
 #if PORTAUDIO
 #if PA18API
@@ -81,8 +81,17 @@ static void usage(const char *argv0) {
 		   "  -a <l>\t\tSpecify Portaudio params to open output device, l = target latency in ms\n"
 #endif
 #endif
-		   "  -a <f>\t\tSpecify sample format (16|24|32) of output file when using -o - to output samples to stdout (interleaved little endian only)\n"
+		   "  -a <f>\t\tSpecify sample format (16|24|32|float) of output file when using -o - to output samples to stdout (interleaved little endian only)\n"
 		   "  -b <stream>:<output>\tSpecify internal Stream and Output buffer sizes in Kbytes. Default is %d:%d\n"
+		   "  \t\t\t Add an s suffix to size in seconds of audio instead (e.g. 60s:20s), resized for each track's codec bitrate and sample rate\n"
+#if LINUX
+		   "  -b <s>:<o>:<dir>\tAs above with the Stream buffer a memory mapped file in dir on local storage, for very large stream buffers\n"
+#endif
+#if LINUX
+		   "  -B <flags>\t\tBuffer memory options, flags = m: map stream and output buffers twice back to back so reads and writes never split at wrap,\n"
+		   "  \t\t\t h: use explicit huge pages for stream and output buffers (otherwise transparent huge pages are requested),\n"
+		   "  \t\t\t z: hold output buffer losslessly compressed, output buffer size becomes the memory used holding up to 4x the audio\n"
+#endif
 		   "  -c <codec1>,<codec2>\tRestrict codecs to those specified, otherwise load all available codecs; known codecs: " CODECS "\n"
 		   "  \t\t\tCodecs reported to LMS in order listed, allowing codec priority refinement.\n"
 		   "  -C <timeout>\t\tClose output device when idle after timeout seconds, default is to keep it open while player is 'on'\n"
@@ -96,6 +105,11 @@ static void usage(const char *argv0) {
 #endif
 		   "  -e <codec1>,<codec2>\tExplicitly exclude native support of one or more codecs; known codecs: " CODECS "\n"
 		   "  -f <logfile>\t\tWrite debug to logfile\n"
+		   "  -F <curve>\t\tShape of fades and crossfades, curve = linear|power|log: linear gain, equal power or logarithmic over 60dB\n"
+		   "  -H <secs>\t\tRetain secs of played audio in the output buffer so small rewinds are played without restreaming\n"
+#if LINUX
+		   "  -I <secs>\t\tRelease stream, output and silence buffer memory after secs stopped or off, reacquired when the next stream starts\n"
+#endif
 #if IR
 		   "  -i [<filename>]\tEnable lirc remote control support (lirc config file ~/.lircrc used if filename not specified)\n"
 #endif
@@ -110,6 +124,7 @@ static void usage(const char *argv0) {
 #if LINUX || FREEBSD || SUN
 		   "  -P <filename>\t\tStore the process id (PID) in filename\n"
 #endif
+		   "  -Q <dither>\t\tDither when volume is applied to S16_LE or S24 output, dither = tpdf|shaped1|shaped2|lipshitz: tpdf, first or second order highpass or 44.1/48kHz psychoacoustic noise shaping\n"
 		   "  -r <rates>[:<delay>]\tSample rates supported, allows output to be off when squeezelite is started; rates = <maxrate>|<minrate>-<maxrate>|<rate1>,<rate2>,<rate3>; delay = optional delay switching rates in ms\n"
 #if GPIO
 			"  -S <Power Script>\tAbsolute path to script to launch on power commands from LMS\n"
@@ -137,6 +152,8 @@ static void usage(const char *argv0) {
 #endif
 # if ALSA
 		   "  -O <mixer device>\tSpecify mixer device, defaults to 'output device'\n"
+		   "  -y <device>[@<trim>[@<f>]]\tAlso play to device, fed from the same output buffer and kept in sync with the output device, trim = ms played later (earlier if negative), f = sample format (16|24|24_3|32|float), repeat for up to 4 devices\n"
+		   "  -k <filename>\t\tCache the sample rates probed for the output device in filename, so later starts need not open it\n"
 		   "  -L \t\t\tList volume controls for output device\n"
 		   "  -U <control>\t\tUnmute ALSA control and set to full volume (not supported with -V)\n"
 		   "  -V <control>\t\tUse ALSA control for volume adjustment, otherwise use software volume adjustment\n"
@@ -305,6 +322,21 @@ int main(int argc, char **argv) {
 	char *modelname = NULL;
 	extern bool pcm_check_header;
 	extern bool user_rates;
+	extern unsigned streambuf_secs;
+	extern unsigned outputbuf_secs;
+	extern unsigned outputbuf_history;
+#if ALSA
+	extern char *rates_cache;
+#endif
+#if LINUX
+	extern const char *streambuf_dir;
+#endif
+#if LINUX
+	extern bool buf_mirror;
+	extern bool buf_huge;
+	extern bool outputbuf_z;
+	extern u32_t idle_release;
+#endif
 	char *logfile = NULL;
 	u8_t mac[6];
 	unsigned stream_buf_size = STREAMBUF_SIZE;
@@ -363,9 +395,12 @@ int main(int argc, char **argv) {
 
 	while (optind < argc && strlen(argv[optind]) >= 2 && argv[optind][0] == '-') {
 		char *opt = argv[optind] + 1;
-		if (strstr("oabcCdefmMnNpPrsZ"
+		if (strstr("oabcCdefFHmMnNpPQrsZ"
 #if ALSA
-				   "UVO"
+				   "UVOky"
+#endif
+#if LINUX
+				   "BI"
 #endif
 				   , opt) && optind < argc - 1) {
 			optarg = argv[optind + 1];
@@ -412,14 +447,53 @@ int main(int argc, char **argv) {
 		case 'a':
 			output_params = optarg;
 			break;
+		case 'H':
+			outputbuf_history = atoi(optarg);
+			break;
+		case 'F':
+			if (!output_fade_curve_set(optarg)) {
+				fprintf(stderr, "\nFade curve settings error: -F %s\n\n", optarg);
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'Q':
+			if (!pack_dither_set(optarg)) {
+				fprintf(stderr, "\nDither settings error: -Q %s\n\n", optarg);
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
 		case 'b': 
 			{
 				char *s = next_param(optarg, ':');
 				char *o = next_param(NULL, ':');
-				if (s) stream_buf_size = atoi(s) * 1024;
-				if (o) output_buf_size = atoi(o) * 1024;
+#if LINUX
+				char *f = next_param(NULL, ':');
+				if (f) streambuf_dir = f;
+#endif
+				if (s) {
+					if (strchr(s, 's')) streambuf_secs = atoi(s);
+					else stream_buf_size = atoi(s) * 1024;
+				}
+				if (o) {
+					if (strchr(o, 's')) outputbuf_secs = atoi(o);
+					else output_buf_size = atoi(o) * 1024;
+				}
 			}
 			break;
+#if LINUX
+		case 'B':
+			if (strchr(optarg, 'm')) buf_mirror = true;
+			if (strchr(optarg, 'h')) buf_huge = true;
+			if (strchr(optarg, 'z')) outputbuf_z = true;
+			break;
+		case 'I':
+			if (atoi(optarg) > 0) {
+				idle_release = atoi(optarg) * 1000;
+			}
+			break;
+#endif
 		case 'c':
 			include_codecs = optarg;
 			break;
@@ -592,6 +666,16 @@ int main(int argc, char **argv) {
 		case 'O':
 			mixer_device = optarg;
 			break;
+		case 'k':
+			rates_cache = optarg;
+			break;
+		case 'y':
+			if (!alsa_add_device(optarg)) {
+				fprintf(stderr, "\nDevice settings error: -y %s\n\n", optarg);
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
 		case 'L':
 			list_mixers(mixer_device);
 			exit(0);
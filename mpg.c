@@ -61,17 +61,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct   if (!decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_not_direct if (!decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct
-#define UNLOCK_O_not_direct
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -88,7 +80,6 @@ static decode_state mpg_decode(void) {
 	u8_t *write_buf;
 
 	LOCK_S;
-	LOCK_O_direct;
 	bytes = min(_buf_used(streambuf), _buf_cont_read(streambuf));
 
 	IF_DIRECT(
@@ -123,13 +114,13 @@ static decode_state mpg_decode(void) {
 			MPG123(m, getformat, m->h, &rate, &channels, &enc);
 			
 			LOG_INFO("setting track_start");
-			LOCK_O_not_direct;
+			LOCK_O;
 			output.next_sample_rate = decode_newstream(rate, output.supported_rates);
 			IF_DSD( output.next_fmt = PCM; )
-			output.track_start = outputbuf->writep;
+			_output_track_start(outputbuf->writep);
 			if (output.fade_mode) _checkfade(true);
 			decode.new_stream = false;
-			UNLOCK_O_not_direct;
+			UNLOCK_O;
 
 		} else {
 			LOG_WARN("format change mid stream - not supported");
@@ -158,8 +149,6 @@ static decode_state mpg_decode(void) {
 		process.in_frames = size / BYTES_PER_FRAME;
 	);
 
-	UNLOCK_O_direct;
-
 	LOG_SDEBUG("write %u frames", size / BYTES_PER_FRAME);
 
 	if (ret == MPG123_DONE || (bytes == 0 && size == 0 && stream.state <= DISCONNECT)) {
@@ -255,6 +244,7 @@ struct codec *register_mpg(void) {
 		mpg_open,     // open
 		mpg_close,    // close
 		mpg_decode,   // decode
+		320,          // bitrate kbps
 	};
 
 	m = malloc(sizeof(struct mpg));
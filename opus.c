@@ -73,17 +73,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct   if (!decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_not_direct if (!decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct
-#define UNLOCK_O_not_direct
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -140,7 +132,7 @@ static decode_state opus_decompress(void) {
 		LOCK_O;
 		output.next_sample_rate = decode_newstream(48000, output.supported_rates);
 		IF_DSD(	output.next_fmt = PCM; )
-		output.track_start = outputbuf->writep;
+		_output_track_start(outputbuf->writep);
 		if (output.fade_mode) _checkfade(true);
 		decode.new_stream = false;
 		UNLOCK_O;
@@ -157,7 +149,6 @@ static decode_state opus_decompress(void) {
 		write_buf = u->write_buf;
 	);
 #else
-	LOCK_O_direct;
 	IF_DIRECT(
 		frames = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
 		write_buf = outputbuf->writep;
@@ -170,10 +161,6 @@ static decode_state opus_decompress(void) {
 	
 	// write the decoded frames into outputbuf then unpack them (they are 16 bits)
 	n = OP(u, read, u->of, (opus_int16*) write_buf, frames * channels, NULL);
-			
-#if FRAME_BUF
-	LOCK_O_direct;
-#endif
 
 	if (n > 0) {
 		frames_t count;
@@ -225,7 +212,6 @@ static decode_state opus_decompress(void) {
 
 		if (stream.state <= DISCONNECT) {
 			LOG_INFO("end of decode");
-			UNLOCK_O_direct;
 			return DECODE_COMPLETE;
 		} else {
 			LOG_INFO("no frame decoded");
@@ -239,12 +225,9 @@ static decode_state opus_decompress(void) {
 	} else {
 
 		LOG_INFO("op_read error: %d", n);
-		UNLOCK_O_direct;
 		return DECODE_COMPLETE;
 	}
 
-	UNLOCK_O_direct;
-
 	return DECODE_RUNNING;
 }
 
@@ -306,6 +289,7 @@ struct codec *register_opus(void) {
 		opus_open, 	  // open
 		opus_close,   // close
 		opus_decompress,  // decode
+		510,              // bitrate kbps
 	};
 
 	u = malloc(sizeof(struct opus));
@@ -23,6 +23,8 @@
 
 #include "squeezelite.h"
 
+#include <math.h>
+
 static log_level loglevel;
 
 struct outputstate output;
@@ -36,31 +38,180 @@ u8_t *silencebuf;
 u8_t *silencebuf_dsd;
 #endif
 
+// silence buffers are read on the realtime path so allocated as hot memory, size and mem retained to free them
+static size_t silencebuf_size;
+static u8_t silencebuf_mem;
+#if DSD
+static size_t silencebuf_dsd_size;
+static u8_t silencebuf_dsd_mem;
+#endif
+
 bool user_rates = false;
 
+// outputbuf sized in seconds of audio at the sample rate of the latest track rather than in bytes, set from command line
+unsigned outputbuf_secs = 0;
+static size_t outputbuf_base;   // bytes set from the command line when not sized in seconds
+static size_t outputbuf_target; // bytes wanted for latest track
+static size_t outputbuf_sized;  // target the current outputbuf was allocated for (allocated size may be rounded up)
+static unsigned outputbuf_rate;
+static u8_t outputbuf_frame_bytes;
+static unsigned outputbuf_fade;   // crossfade seconds outputbuf_target allows for
+
+// outputbuf held compressed, set from command line
+bool outputbuf_z = false;
+
+// seconds of played audio retained in outputbuf for rewinds, set from command line
+unsigned outputbuf_history = 0;
+
+// shape of fades and crossfades, set from command line
+fade_curve output_fade_curve = FADE_LINEAR;
+
+// fade gain through a fade, interpolated between FADE_LUT + 1 points filled for output_fade_curve at init
+#define FADE_LUT 256
+#define FADE_LOG_DB 60.0F
+static s32_t fade_lut[FADE_LUT + 2];
+
+// volume changes are ramped over this time to avoid zipper noise
+#define GAIN_RAMP_MS 10
+
+static const char *fade_curve_names[] = { "linear", "power", "log" };
+
 #define LOCK   mutex_lock(outputbuf->mutex)
 #define UNLOCK mutex_unlock(outputbuf->mutex)
 
 // functions starting _* are called with mutex locked
 
+// bytes and frames of the playing track from readp forward to a position in outputbuf, allowing for the position having wrapped
+static inline size_t _bytes_to(u8_t *p) {
+	return p >= outputbuf->readp ? p - outputbuf->readp : p + outputbuf->size - outputbuf->readp;
+}
+
+static inline frames_t _frames_to(u8_t *p) {
+	return _bytes_to(p) / output.frame_bytes;
+}
+
+// marker queue - i counts from the oldest queued marker
+static inline struct marker *_marker(unsigned i) {
+	return &output.markers[(output.marker_head + i) % OUTPUT_MARKERS];
+}
+
+static inline struct marker *_marker_tail(void) {
+	return output.marker_count ? _marker(output.marker_count - 1) : NULL;
+}
+
+// start of the last decoded track if it has not yet been reached by the output thread
+static struct marker *_marker_track(void) {
+	unsigned i = output.marker_count;
+	while (i--) {
+		if (_marker(i)->track) {
+			return _marker(i);
+		}
+	}
+	return NULL;
+}
+
+static struct marker *_marker_push(u8_t *pos) {
+	struct marker *m;
+	if (output.marker_count == OUTPUT_MARKERS) {
+		// output_space holds back decoding before this is reached
+		LOG_WARN("marker queue full, replacing last marker");
+	} else {
+		output.marker_count++;
+	}
+	m = _marker(output.marker_count - 1);
+	memset(m, 0, sizeof(*m));
+	m->pos = pos;
+	return m;
+}
+
+// queue a fade beginning at pos, sharing the last marker if at the same position
+static void _marker_fade(u8_t *pos, fade_dir dir, u8_t *end) {
+	struct marker *m = _marker_tail();
+	if (!m || m->pos != pos) {
+		m = _marker_push(pos);
+	}
+	m->fade_dir = dir;
+	m->fade_mode = output.fade_mode;
+	m->fade_end = end;
+}
+
+// parameters of a track are those being set by the decode thread until sealed once its decode completes
+static void _marker_params(struct marker *m, struct marker *t) {
+	*t = *m;
+	if (!m->sealed) {
+		t->sample_rate = output.next_sample_rate;
+		t->replay_gain = output.next_replay_gain;
+		t->frame_bytes = output.next_frame_bytes;
+		IF_DSD(
+			t->fmt = output.next_fmt;
+		)
+	}
+}
+
+// called by the decode thread when a track has been decoded, or before starting the next
+void _output_seal(void) {
+	struct marker *m = _marker_track();
+	if (m && !m->sealed) {
+		struct marker t;
+		_marker_params(m, &t);
+		*m = t;
+		m->sealed = true;
+	}
+}
+
+// called by codecs where a new track starts in outputbuf
+void _output_track_start(u8_t *pos) {
+	_output_seal();
+	_marker_push(pos)->track = true;
+}
+
+// bytes from a to b going forward round outputbuf
+static inline size_t _dist(u8_t *a, u8_t *b) {
+	return b >= a ? b - a : b + outputbuf->size - a;
+}
+
+// Q16 gain cur frames of dur into a fade
+static s32_t _fade_gain(frames_t cur, frames_t dur) {
+	u32_t pos = dur ? (u32_t)(((u64_t)min(cur, dur) << 16) / dur) : FIXED_ONE;
+	unsigned i = pos >> 8;
+	return fade_lut[i] + (((fade_lut[i + 1] - fade_lut[i]) * (s32_t)(pos & 0xff)) >> 8);
+}
+
+// gain of volume vol with replay gain and fade gain, inverted if set
+static inline s32_t _chunk_gain(s32_t vol, u32_t replay_gain, s32_t fade_gain) {
+	s32_t g = replay_gain ? gain(vol, replay_gain) : vol;
+	if (fade_gain != FIXED_ONE) {
+		g = gain(g, fade_gain);
+	}
+	return output.invert ? -g : g;
+}
+
+// Q16 crossfade gain of a track with its replay gain
+static inline s32_t _cross_gain(frames_t cur, frames_t dur, u32_t replay_gain) {
+	s32_t g = _fade_gain(cur, dur);
+	return replay_gain ? gain(g, replay_gain) : g;
+}
+
+// per frame step from gain a to gain b over frames
+static inline s32_t _ramp_step(s32_t a, s32_t b, frames_t frames) {
+	return frames ? (s32_t)((s64_t)(b - a) * (1 << RAMP_SHIFT) / (s64_t)frames) : 0;
+}
+
 frames_t _output_frames(frames_t avail) {
 
 	frames_t frames, size;
 	bool silence;
 	u8_t flags = output.channels;
 	
-	s32_t cross_gain_in = 0, cross_gain_out = 0; s32_t *cross_ptr = NULL;
-	
-	s32_t gainL = output.current_replay_gain ? gain(output.gainL, output.current_replay_gain) : output.gainL;
-	s32_t gainR = output.current_replay_gain ? gain(output.gainR, output.current_replay_gain) : output.gainR;
+	s32_t gainL, gainR;
 
-	if (output.invert) { gainL = -gainL; gainR = -gainR; }
-
-	frames = _buf_used(outputbuf) / BYTES_PER_FRAME;
+	// whilst buffering outputbuf only holds the new track so count frames at its width
+	frames = _buf_used(outputbuf) / (output.state == OUTPUT_BUFFER ? output.next_frame_bytes : output.frame_bytes);
 	silence = false;
 
 	// start when threshold met
-	if (output.state == OUTPUT_BUFFER && frames > output.threshold * output.next_sample_rate / 10 && frames > output.start_frames) {
+	if (output.state == OUTPUT_BUFFER && ((frames > output.threshold * output.next_sample_rate / 10 && frames > output.start_frames) ||
+										  output.marker_count + 2 > OUTPUT_MARKERS)) {
 		output.state = OUTPUT_RUNNING;
 		LOG_INFO("start buffer frames: %u", frames);
 		wake_controller();
@@ -74,9 +225,11 @@ frames_t _output_frames(frames_t avail) {
 			frames -= skip;
 			output.frames_played += skip;
 			while (skip > 0) {
-				frames_t cont_frames = min(skip, _buf_cont_read(outputbuf) / BYTES_PER_FRAME);
+				frames_t cont_frames = min(skip, _buf_cont_read(outputbuf) / output.frame_bytes);
+				_zbuf_stage(outputbuf->readp, cont_frames * output.frame_bytes);
 				skip -= cont_frames;
-				_buf_inc_readp(outputbuf, cont_frames * BYTES_PER_FRAME);
+				_buf_inc_readp(outputbuf, cont_frames * output.frame_bytes);
+				output.history = min(output.history + cont_frames * output.frame_bytes, output.history_size);
 			}
 		}
 		output.state = OUTPUT_RUNNING;
@@ -95,16 +248,23 @@ frames_t _output_frames(frames_t avail) {
 		}
 	}
 	
-	// start at - play silence until jiffies reached
+	// start at - play silence until jiffies reached, the next frame written is heard once the device_frames queued
+	// in the device have played so silence is sized in frames from when they were measured to reach start_at exactly
 	if (output.state == OUTPUT_START_AT) {
-		u32_t now = gettime_ms();
-		if (now >= output.start_at || output.start_at > now + 10000) {
+		u64_t now_us = output.updated_us ? output.updated_us : gettime_us();
+		s32_t until_ms = (s32_t)(output.start_at - (u32_t)(now_us / 1000));
+		s64_t until_us = (s64_t)until_ms * 1000 - (s64_t)(now_us % 1000);
+		s64_t delta_frames = until_us * output.current_sample_rate / 1000000 - output.device_frames;
+		if (delta_frames <= 0 || until_ms > 10000) {
 			output.state = OUTPUT_RUNNING;
+			if (until_ms <= 10000 && output.current_sample_rate) {
+				output.start_error_us = (s32_t)((s64_t)output.device_frames * 1000000 / output.current_sample_rate - until_us);
+				output.start_measured = true;
+				LOG_INFO("start at: %u error: %d us", output.start_at, output.start_error_us);
+			}
 		} else {
-			u32_t delta_frames = (output.start_at - now) * output.current_sample_rate / 1000;
 			silence = true;
-			frames = min(avail, delta_frames);
-			frames = min(frames, MAX_SILENCE_FRAMES);
+			frames = min(avail, (frames_t)min(delta_frames, MAX_SILENCE_FRAMES));
 		}
 	}
 	
@@ -120,151 +280,240 @@ frames_t _output_frames(frames_t avail) {
 	
 	while (size > 0) {
 		frames_t out_frames;
-		frames_t cont_frames = _buf_cont_read(outputbuf) / BYTES_PER_FRAME;
+		frames_t cont_frames = _buf_cont_read(outputbuf) / output.frame_bytes;
+		bool boundary = false;
 		int wrote;
+		// fade position, gains at the start of the chunk and ramped per frame to the end of it
+		frames_t fade_cur = 0, fade_dur = 0;
+		s32_t volL = output.ramp_gainL, volR = output.ramp_gainR, vol_endL, vol_endR;
+		struct gain_ramp ramp = { 0 };
+		bool ramping = false;
+		struct cross_mix cross = { 0 };
+		bool crossing = false;
 		
-		if (output.track_start && !silence) {
-			if (output.track_start == outputbuf->readp) {
+		// markers are queued in outputbuf order so only the oldest is checked, chunks end at the next marker
+		while (output.marker_count && !silence) {
+			struct marker *m = _marker(0);
+			struct marker t;
+
+			if (m->pos != outputbuf->readp) {
+				cont_frames = min(cont_frames, _frames_to(m->pos));
+				break;
+			}
+
+			_marker_params(m, &t);
+
+			if (t.track) {
 				unsigned delay = 0;
-				if (output.current_sample_rate != output.next_sample_rate) {
+				if (output.current_sample_rate != t.sample_rate) {
 					delay = output.rate_delay;
 #if PULSEAUDIO
-					set_sample_rate(output.next_sample_rate);
+					set_sample_rate(t.sample_rate);
 #endif
 				}
 				IF_DSD(
-				   if (output.outfmt != output.next_fmt) {
+				   if (output.outfmt != t.fmt) {
 					   delay = output.dsd_delay;
 				   }
 				)
-				frames -= size;
 				// add silence delay in two halves, before and after track start on rate or pcm-dop change
 				if (delay) {
 					output.state = OUTPUT_PAUSE_FRAMES;
 					if (!output.delay_active) {
 						output.pause_frames = output.current_sample_rate * delay / 2000;
 						output.delay_active = true;  // first delay - don't process track start
+						boundary = true;
 						break;
 					} else {
-						output.pause_frames = output.next_sample_rate * delay / 2000;
+						output.pause_frames = t.sample_rate * delay / 2000;
 						output.delay_active = false; // second delay - process track start
 					}
 				}
-				LOG_INFO("track start sample rate: %u replay_gain: %u", output.next_sample_rate, output.next_replay_gain);
+				LOG_INFO("track start sample rate: %u replay_gain: %u", t.sample_rate, t.replay_gain);
 				output.frames_played = 0;
 				output.track_started = true;
 				output.track_start_time = gettime_ms();
-				output.current_sample_rate = output.next_sample_rate;
+				output.current_sample_rate = t.sample_rate;
+				output.history = 0;
 				IF_DSD(
-				   output.outfmt = output.next_fmt;
+				   output.outfmt = t.fmt;
 				)
-				if (output.fade == FADE_INACTIVE || output.fade_mode != FADE_CROSSFADE) {
-					output.current_replay_gain = output.next_replay_gain;
+				if (t.fade_dir == FADE_CROSS) {
+					// the track fading out is read at its own width until the crossfade completes
+					output.cross_replay_gain = t.replay_gain;
+					output.cross_frame_bytes = t.frame_bytes;
+				} else {
+					output.current_replay_gain = t.replay_gain;
+					output.frame_bytes = t.frame_bytes;
 				}
-				output.track_start = NULL;
+			}
+
+			if (t.fade_dir) {
+				LOG_INFO("fade start reached");
+				output.fade = FADE_ACTIVE;
+				output.fade_dir = t.fade_dir;
+				output.current_fade_mode = t.fade_mode;
+				output.fade_start = t.pos;
+				output.fade_end = t.fade_end;
+			}
+
+			output.marker_head = (output.marker_head + 1) % OUTPUT_MARKERS;
+			output.marker_count--;
+
+			if (t.track) {
+				boundary = true;
 				break;
-			} else if (output.track_start > outputbuf->readp) {
-				// reduce cont_frames so we find the next track start at beginning of next chunk
-				cont_frames = min(cont_frames, (output.track_start - outputbuf->readp) / BYTES_PER_FRAME);
 			}
 		}
 
-		IF_DSD(
-			if (output.outfmt != PCM) {
-				gainL = gainR = FIXED_ONE;
-			}
-		)
-		
+		// return after a track start so the new track is played from the next call
+		if (boundary) {
+			frames -= size;
+			break;
+		}
+
 		if (output.fade && !silence) {
-			if (output.fade == FADE_DUE) {
-				if (output.fade_start == outputbuf->readp) {
-					LOG_INFO("fade start reached");
-					output.fade = FADE_ACTIVE;
-				} else if (output.fade_start > outputbuf->readp) {
-					cont_frames = min(cont_frames, (output.fade_start - outputbuf->readp) / BYTES_PER_FRAME);
-				}
-			}
 			if (output.fade == FADE_ACTIVE) {
 				// find position within fade
-				frames_t cur_f = outputbuf->readp >= output.fade_start ? (outputbuf->readp - output.fade_start) / BYTES_PER_FRAME : 
-					(outputbuf->readp + outputbuf->size - output.fade_start) / BYTES_PER_FRAME;
-				frames_t dur_f = output.fade_end >= output.fade_start ? (output.fade_end - output.fade_start) / BYTES_PER_FRAME :
-					(output.fade_end + outputbuf->size - output.fade_start) / BYTES_PER_FRAME;
+				frames_t cur_f = outputbuf->readp >= output.fade_start ? (outputbuf->readp - output.fade_start) / output.frame_bytes : 
+					(outputbuf->readp + outputbuf->size - output.fade_start) / output.frame_bytes;
+				frames_t dur_f = output.fade_end >= output.fade_start ? (output.fade_end - output.fade_start) / output.frame_bytes :
+					(output.fade_end + outputbuf->size - output.fade_start) / output.frame_bytes;
 				if (cur_f >= dur_f) {
-					if (output.fade_mode == FADE_INOUT && output.fade_dir == FADE_DOWN) {
+					if (output.current_fade_mode == FADE_INOUT && output.fade_dir == FADE_DOWN) {
 						LOG_INFO("fade down complete, starting fade up");
 						output.fade_dir = FADE_UP;
 						output.fade_start = outputbuf->readp;
-						output.fade_end = outputbuf->readp + dur_f * BYTES_PER_FRAME;
+						output.fade_end = outputbuf->readp + dur_f * output.frame_bytes;
 						if (output.fade_end >= outputbuf->wrap) {
 							output.fade_end -= outputbuf->size;
 						}
 						cur_f = 0;
-					} else if (output.fade_mode == FADE_CROSSFADE) {
+					} else if (output.fade_dir == FADE_CROSS) {
 						LOG_INFO("crossfade complete");
-						if (_buf_used(outputbuf) >= dur_f * BYTES_PER_FRAME) {
-							_buf_inc_readp(outputbuf, dur_f * BYTES_PER_FRAME);
+						output.frame_bytes = output.cross_frame_bytes;
+						if (_buf_used(outputbuf) >= dur_f * output.frame_bytes) {
+							_zbuf_stage(outputbuf->readp, dur_f * output.frame_bytes);
+							_buf_inc_readp(outputbuf, dur_f * output.frame_bytes);
+							output.history = 0; // behind readp is the mix of both tracks
 							LOG_INFO("skipped crossfaded start");
 						} else {
 							LOG_WARN("unable to skip crossfaded start");
 						}
 						output.fade = FADE_INACTIVE;
-						output.current_replay_gain = output.next_replay_gain;
+						output.current_replay_gain = output.cross_replay_gain;
 					} else {
 						LOG_INFO("fade complete");
 						output.fade = FADE_INACTIVE;
 					}
 				}
-				// if fade in progress set fade gain, ensure cont_frames reduced so we get to end of fade at start of chunk
+				// if fade in progress note position for the fade gain, ensure cont_frames reduced so we get to end of fade at
+				// start of chunk
 				if (output.fade) {
-					if (output.fade_end > outputbuf->readp) {
-						cont_frames = min(cont_frames, (output.fade_end - outputbuf->readp) / BYTES_PER_FRAME);
-					}
-					if (output.fade_dir == FADE_UP || output.fade_dir == FADE_DOWN) {
-						// fade in, in-out, out handled via altering standard gain
-						s32_t fade_gain;
-						if (output.fade_dir == FADE_DOWN) {
-							cur_f = dur_f - cur_f;
-						}
-						fade_gain = to_gain((float)cur_f / (float)dur_f);
-						gainL = gain(gainL, fade_gain);
-						gainR = gain(gainR, fade_gain);
-						if (output.invert) { gainL = -gainL; gainR = -gainR; }
+					if (output.fade_end != outputbuf->readp) {
+						cont_frames = min(cont_frames, _frames_to(output.fade_end));
 					}
+					fade_cur = cur_f;
+					fade_dur = dur_f;
 					if (output.fade_dir == FADE_CROSS) {
-						// cross fade requires special treatment - performed later based on these values
+						// cross fade mixes the track fading out at readp with the track fading in from fade_end
 						// support different replay gain for old and new track by retaining old value until crossfade completes
-						if (_buf_used(outputbuf) / BYTES_PER_FRAME > dur_f + size) { 
-							cross_gain_in  = to_gain((float)cur_f / (float)dur_f);
-							cross_gain_out = FIXED_ONE - cross_gain_in;
-							if (output.current_replay_gain) {
-								cross_gain_out = gain(cross_gain_out, output.current_replay_gain);
-							}
-							if (output.next_replay_gain) {
-								cross_gain_in = gain(cross_gain_in, output.next_replay_gain);
-							}
-							gainL = output.gainL;
-							gainR = output.gainR;
-							if (output.invert) { gainL = -gainL; gainR = -gainR; }
-							cross_ptr = (s32_t *)(output.fade_end + cur_f * BYTES_PER_FRAME);
+						if (_buf_used(outputbuf) > (dur_f - cur_f) * output.frame_bytes + (cur_f + size) * output.cross_frame_bytes) {
+							cross.ptr = output.fade_end + cur_f * output.cross_frame_bytes;
+							cross.in_bytes = output.cross_frame_bytes;
+							cross.out_bytes = output.frame_bytes;
+							crossing = true;
 						} else {
+							// the track fading out plays to its end and the new track from its start, unmixed
 							LOG_INFO("unable to continue crossfade - too few samples");
-							output.fade = FADE_INACTIVE;
+							output.fade = FADE_DROPPED;
 						}
 					}
 				}
 			}
+			if (output.fade == FADE_DROPPED) {
+				// frames of the new track are read at its width from where the crossfade would have ended
+				if (outputbuf->readp == output.fade_end) {
+					output.frame_bytes = output.cross_frame_bytes;
+					output.current_replay_gain = output.cross_replay_gain;
+					output.fade = FADE_INACTIVE;
+				} else {
+					cont_frames = min(cont_frames, _frames_to(output.fade_end));
+				}
+			}
+		}
+
+		// volume changes ramp over GAIN_RAMP_MS, chunks ending where the ramp does
+		if (!output.ramp_frames && (volL != (s32_t)output.gainL || volR != (s32_t)output.gainR)) {
+			output.ramp_frames = max(output.current_sample_rate * GAIN_RAMP_MS / 1000, 1);
+		}
+		if (output.ramp_frames) {
+			cont_frames = min(cont_frames, output.ramp_frames);
 		}
 		
 		out_frames = !silence ? min(size, cont_frames) : size;
-		
+
+		vol_endL = volL; vol_endR = volR;
+		if (output.ramp_frames) {
+			frames_t n = min(out_frames, output.ramp_frames);
+			vol_endL = volL + (s32_t)((s64_t)((s32_t)output.gainL - volL) * n / output.ramp_frames);
+			vol_endR = volR + (s32_t)((s64_t)((s32_t)output.gainR - volR) * n / output.ramp_frames);
+		}
+
+		if (!silence && crossing) {
+			// volume applies to the mix, the fade curve and replay gain of each track to the crossfade gains
+			frames_t end = min(fade_cur + out_frames, fade_dur);
+			gainL = _chunk_gain(volL, 0, FIXED_ONE);
+			gainR = _chunk_gain(volR, 0, FIXED_ONE);
+			cross.gain_in = _cross_gain(fade_cur, fade_dur, output.cross_replay_gain);
+			cross.gain_out = _cross_gain(fade_dur - fade_cur, fade_dur, output.current_replay_gain);
+			ramp.stepL = _ramp_step(gainL, _chunk_gain(vol_endL, 0, FIXED_ONE), out_frames);
+			ramp.stepR = _ramp_step(gainR, _chunk_gain(vol_endR, 0, FIXED_ONE), out_frames);
+			ramp.step_in = _ramp_step(cross.gain_in, _cross_gain(end, fade_dur, output.cross_replay_gain), out_frames);
+			ramp.step_out = _ramp_step(cross.gain_out, _cross_gain(fade_dur - end, fade_dur, output.current_replay_gain), out_frames);
+		} else if (!silence && output.fade == FADE_ACTIVE && (output.fade_dir == FADE_UP || output.fade_dir == FADE_DOWN)) {
+			// fade in, in-out, out handled via altering standard gain
+			frames_t end = min(fade_cur + out_frames, fade_dur);
+			frames_t cur = output.fade_dir == FADE_UP ? fade_cur : fade_dur - fade_cur;
+			if (output.fade_dir == FADE_DOWN) {
+				end = fade_dur - end;
+			}
+			gainL = _chunk_gain(volL, output.current_replay_gain, _fade_gain(cur, fade_dur));
+			gainR = _chunk_gain(volR, output.current_replay_gain, _fade_gain(cur, fade_dur));
+			ramp.stepL = _ramp_step(gainL, _chunk_gain(vol_endL, output.current_replay_gain, _fade_gain(end, fade_dur)), out_frames);
+			ramp.stepR = _ramp_step(gainR, _chunk_gain(vol_endR, output.current_replay_gain, _fade_gain(end, fade_dur)), out_frames);
+		} else {
+			gainL = _chunk_gain(volL, output.current_replay_gain, FIXED_ONE);
+			gainR = _chunk_gain(volR, output.current_replay_gain, FIXED_ONE);
+			ramp.stepL = _ramp_step(gainL, _chunk_gain(vol_endL, output.current_replay_gain, FIXED_ONE), out_frames);
+			ramp.stepR = _ramp_step(gainR, _chunk_gain(vol_endR, output.current_replay_gain, FIXED_ONE), out_frames);
+		}
+
 		IF_DSD(
 			if (output.outfmt != PCM) {
-				flags = 0;
+				// no gain for dsd, dop markers and invert are applied by the output as it packs
+				gainL = gainR = FIXED_ONE;
+				memset(&ramp, 0, sizeof(ramp));
+				flags = (output.outfmt == DOP || output.outfmt == DOP_S24_LE || output.outfmt == DOP_S24_3LE ? DSD_DOP : 0) |
+					(output.invert ? DSD_INVERT : 0);
 			}
 		)
 
-		wrote = output.write_cb(out_frames, silence, gainL, gainR, flags, cross_gain_in, cross_gain_out, &cross_ptr);
+		ramping = !silence && (ramp.stepL || ramp.stepR || ramp.step_in || ramp.step_out);
+
+		if (!silence && _pack_select(&output.pack, output.format, flags, gainL == FIXED_ONE && gainR == FIXED_ONE && !ramping)) {
+			LOG_DEBUG("pack: %s flags: 0x%x gain: %s", output.pack.name, output.pack.flags, output.pack.unity ? "unity" : "scaled");
+		}
+
+		if (!silence) {
+			_zbuf_stage(outputbuf->readp, out_frames * output.frame_bytes);
+			if (crossing) {
+				_zbuf_stage(cross.ptr, out_frames * cross.in_bytes);
+			}
+		}
+
+		wrote = output.write_cb(out_frames, silence, gainL, gainR, flags, crossing && !silence ? &cross : NULL,
+								ramping ? &ramp : NULL);
 
 		if (wrote <= 0) {
 			frames -= size;
@@ -273,14 +522,30 @@ frames_t _output_frames(frames_t avail) {
 			out_frames = (frames_t)wrote;
 		}
 
+		// the volume ramp advances by the frames written, which may be fewer than asked for
+		if (output.ramp_frames) {
+			frames_t n = min(out_frames, output.ramp_frames);
+			output.ramp_gainL = volL + (s32_t)((s64_t)((s32_t)output.gainL - volL) * n / output.ramp_frames);
+			output.ramp_gainR = volR + (s32_t)((s64_t)((s32_t)output.gainR - volR) * n / output.ramp_frames);
+			output.ramp_frames -= n;
+		}
+
 		size -= out_frames;
 
 		_vis_export(outputbuf, &output, out_frames, silence);
 
 		if (!silence) {
-			_buf_inc_readp(outputbuf, out_frames * BYTES_PER_FRAME);
+			_buf_inc_readp(outputbuf, out_frames * output.frame_bytes);
+			output.history = min(output.history + out_frames * output.frame_bytes, output.history_size);
 			output.frames_played += out_frames;
 		}
+
+		// audio in the tail can only be replayed as far back as the history, which bounds rewinds of it
+		if (silence != output.tail_drop) {
+			output.tail_drop = silence;
+			output.tail_frames = 0;
+		}
+		output.tail_frames += min(out_frames, ~output.tail_frames); // saturates as flushing sets it to the maximum
 	}
 			
 	LOG_SDEBUG("wrote %u frames", frames);
@@ -288,104 +553,292 @@ frames_t _output_frames(frames_t avail) {
 	return frames;
 }
 
+// resize outputbuf retaining buffered audio, queued markers are the only positions which need rebasing as no fade is active
+static bool _output_resize(size_t size) {
+	size_t pos[OUTPUT_MARKERS], end[OUTPUT_MARKERS];
+	unsigned i;
+	for (i = 0; i < output.marker_count; ++i) {
+		pos[i] = _bytes_to(_marker(i)->pos);
+		end[i] = _marker(i)->fade_dir ? _bytes_to(_marker(i)->fade_end) : 0;
+	}
+	if (!_buf_resize(outputbuf, size)) {
+		return false;
+	}
+	output.history = 0;
+	for (i = 0; i < output.marker_count; ++i) {
+		_marker(i)->pos = outputbuf->readp + pos[i];
+		if (_marker(i)->fade_dir) {
+			// a fade in may extend beyond the audio written
+			_marker(i)->fade_end = outputbuf->readp + end[i] % outputbuf->size;
+		}
+	}
+	return true;
+}
+
+// space the decoder may fill in outputbuf, when sized in seconds also resizes it for the sample rate of a new track, and
+// grows it to hold the crossfade set by the server
+// called by the decode thread between codec decode calls, so no codec holds pointers into outputbuf and next_sample_rate
+// (which only the decode thread writes) can be read without the mutex, fade settings are set by slimproto before a
+// track is decoded and a change while decoding is picked up on a later call
+unsigned output_space(void) {
+	unsigned space = zbuf_space(_buf_space(outputbuf));
+	unsigned fade;
+	size_t keep = min(output.history_size, outputbuf->size / 2);
+
+	// played audio retained for rewinds is kept out of the space offered to the decoder, a decode call may write beyond
+	// this so the history available is limited to what remains unwritten behind readp
+	space = space > keep ? space - keep : 0;
+
+	// a decode call queues at most a track start and a fade, so wait for the output thread to free space in the queue
+	if (output.marker_count + 2 > OUTPUT_MARKERS) {
+		return 0;
+	}
+
+	if (outputbuf_z) {
+		return space;
+	}
+
+	fade = output.fade_mode == FADE_CROSSFADE ? output.fade_secs : 0;
+
+	if (output.next_sample_rate && (output.next_sample_rate != outputbuf_rate || output.next_frame_bytes != outputbuf_frame_bytes ||
+									fade != outputbuf_fade)) {
+		outputbuf_rate = output.next_sample_rate;
+		outputbuf_frame_bytes = output.next_frame_bytes;
+		outputbuf_fade = fade;
+		outputbuf_target = outputbuf_secs ?
+			max((size_t)outputbuf_secs * outputbuf_rate * outputbuf_frame_bytes, OUTPUTBUF_SIZE_MIN) : outputbuf_base;
+		// a crossfade holds the end of one track and the start of the next, within 90% of outputbuf
+		outputbuf_target = max(outputbuf_target, (size_t)fade * outputbuf_rate * outputbuf_frame_bytes / 9 * 20);
+		outputbuf_target -= outputbuf_target % BYTES_PER_FRAME;
+		LOG_INFO("outputbuf target: %u bytes for %u seconds and %u second crossfade at %u", outputbuf_target, outputbuf_secs,
+				 fade, outputbuf_rate);
+	}
+
+	if (outputbuf_target != outputbuf_sized) {
+		keep = min(output.history_size, outputbuf_target / 2);
+		LOCK;
+		// grow now, shrink once enough has drained, fades hold positions behind readp so wait for them to complete
+		// contents move to the start of the new allocation so wait for readp to be full frame aligned to keep any
+		// full width frames following narrow ones aligned
+		if (output.fade == FADE_INACTIVE && _buf_used(outputbuf) < outputbuf_target &&
+			(outputbuf->readp - outputbuf->buf) % BYTES_PER_FRAME == 0) {
+			if (_output_resize(outputbuf_target)) {
+				LOG_INFO("outputbuf: %u bytes at %p" BUF_MEM_FMT, outputbuf->size, outputbuf->buf, BUF_MEM_ARGS(outputbuf->mem));
+			} else {
+				LOG_WARN("unable to resize outputbuf, keeping %u bytes", outputbuf->size);
+			}
+			outputbuf_sized = outputbuf_target;
+		}
+		UNLOCK;
+		space = _buf_space(outputbuf);
+		space = space > keep ? space - keep : 0;
+	}
+
+	// hold back decoding until enough has been played to shrink
+	if (outputbuf_target != outputbuf_sized && outputbuf_target < outputbuf->size) {
+		size_t used = _buf_used(outputbuf);
+		space = used + 1 < outputbuf_target ? min(space, outputbuf_target - used - 1) : 0;
+	}
+
+	return space;
+}
+
+// frames of the playing track retained behind readp
+frames_t _output_history(void) {
+	return min(output.history, _buf_space(outputbuf)) / output.frame_bytes;
+}
+
+// move back within the retained history, not while fading as fade positions are behind readp
+// called with the decode mutex held as well as the output mutex, codecs size writes from their own unlocked view of the
+// space so a decode call in progress could otherwise overwrite the history being returned to
+bool _output_rewind(frames_t frames) {
+	if (output.fade != FADE_INACTIVE || frames > _output_history()) {
+		return false;
+	}
+	_buf_dec_readp(outputbuf, frames * output.frame_bytes);
+	output.history -= frames * output.frame_bytes;
+	output.frames_played -= min(frames, output.frames_played);
+	return true;
+}
+
 void _checkfade(bool start) {
 	frames_t bytes;
+	u8_t frame_bytes;
+	struct marker *m;
+	u8_t *fade_start, *fade_end;
 
 	LOG_INFO("fade mode: %u duration: %u %s", output.fade_mode, output.fade_secs, start ? "track-start" : "track-end");
 
-	bytes = output.next_sample_rate * BYTES_PER_FRAME * output.fade_secs;
+	// fades are within the track being decoded so sized at its frame width
+	frame_bytes = output.next_frame_bytes;
+
+	bytes = output.next_sample_rate * frame_bytes * output.fade_secs;
 	if (output.fade_mode == FADE_INOUT) {
 		/* align on a frame boundary */
-		bytes = ((bytes / 2) / BYTES_PER_FRAME) * BYTES_PER_FRAME;
+		bytes = ((bytes / 2) / frame_bytes) * frame_bytes;
 	}
 
 	if (start && (output.fade_mode == FADE_IN || (output.fade_mode == FADE_INOUT && _buf_used(outputbuf) == 0))) {
-		bytes = min(bytes, outputbuf->size - BYTES_PER_FRAME); // shorter than full buffer otherwise start and end align
-		LOG_INFO("fade IN: %u frames", bytes / BYTES_PER_FRAME);
-		output.fade = FADE_DUE;
-		output.fade_dir = FADE_UP;
-		output.fade_start = outputbuf->writep;
-		output.fade_end = output.fade_start + bytes;
-		if (output.fade_end >= outputbuf->wrap) {
-			output.fade_end -= outputbuf->size;
+		bytes = min(bytes, outputbuf->size - frame_bytes); // shorter than full buffer otherwise start and end align
+		LOG_INFO("fade IN: %u frames", bytes / frame_bytes);
+		fade_end = outputbuf->writep + bytes;
+		if (fade_end >= outputbuf->wrap) {
+			fade_end -= outputbuf->size;
 		}
+		_marker_fade(outputbuf->writep, FADE_UP, fade_end);
 	}
 
 	if (!start && (output.fade_mode == FADE_OUT || output.fade_mode == FADE_INOUT)) {
 		bytes = min(_buf_used(outputbuf), bytes);
-		LOG_INFO("fade %s: %u frames", output.fade_mode == FADE_INOUT ? "IN-OUT" : "OUT", bytes / BYTES_PER_FRAME);
-		output.fade = FADE_DUE;
-		output.fade_dir = FADE_DOWN;
-		output.fade_start = outputbuf->writep - bytes;
-		if (output.fade_start < outputbuf->buf) {
-			output.fade_start += outputbuf->size;
+		if ((m = _marker_tail()) != NULL) {
+			// keep the queue in order, so don't fade back beyond the start of this track if not yet played
+			bytes = min(bytes, _dist(m->pos, outputbuf->writep));
+		}
+		LOG_INFO("fade %s: %u frames", output.fade_mode == FADE_INOUT ? "IN-OUT" : "OUT", bytes / frame_bytes);
+		fade_start = outputbuf->writep - bytes;
+		if (fade_start < outputbuf->buf) {
+			fade_start += outputbuf->size;
 		}
-		output.fade_end = outputbuf->writep;
+		_marker_fade(fade_start, FADE_DOWN, outputbuf->writep);
 	}
 
 	if (start && output.fade_mode == FADE_CROSSFADE) {
 		if (_buf_used(outputbuf) != 0) {
-			if (output.next_sample_rate != output.current_sample_rate) {
+			struct marker *track = _marker_tail(), *prev = NULL;
+			unsigned i;
+			if (!track) {
+				return;
+			}
+			// the previous track is the last queued before this one, or if none the playing track
+			for (i = output.marker_count - 1; i-- > 0; ) {
+				if (_marker(i)->track) {
+					prev = _marker(i);
+					break;
+				}
+			}
+			if (output.next_sample_rate != (prev ? prev->sample_rate : output.current_sample_rate)) {
+				// decode_newstream resamples to the previous rate when a resampler is available
 				LOG_INFO("crossfade disabled as sample rates differ");
 				return;
 			}
+			// the fade is within the previous track so sized at its frame width
+			bytes = bytes / frame_bytes * output.prev_frame_bytes;
 			bytes = min(bytes, _buf_used(outputbuf));               // max of current remaining samples from previous track
 			bytes = min(bytes, (frames_t)(outputbuf->size * 0.9));  // max of 90% of outputbuf as we consume additional buffer during crossfade
-			LOG_INFO("CROSSFADE: %u frames", bytes / BYTES_PER_FRAME);
-			output.fade = FADE_DUE;
-			output.fade_dir = FADE_CROSS;
-			output.fade_start = outputbuf->writep - bytes;
-			if (output.fade_start < outputbuf->buf) {
-				output.fade_start += outputbuf->size;
+			if (output.marker_count > 1) {
+				// keep the queue in order, so don't start before the last queued marker
+				bytes = min(bytes, _dist(_marker(output.marker_count - 2)->pos, outputbuf->writep));
 			}
-			output.fade_end = outputbuf->writep;
-			output.track_start = output.fade_start;
-		} else if (outputbuf->size == OUTPUTBUF_SIZE && outputbuf->readp == outputbuf->buf) {
-			// if default setting used and nothing in buffer attempt to resize to provide full crossfade support
-			LOG_INFO("resize outputbuf for crossfade");
-			_buf_resize(outputbuf, OUTPUTBUF_SIZE_CROSSFADE);
-#if LINUX || FREEBSD
-			touch_memory(outputbuf->buf, outputbuf->size);
-#endif			
+			bytes -= bytes % output.prev_frame_bytes;
+			LOG_INFO("CROSSFADE: %u frames", bytes / output.prev_frame_bytes);
+			fade_start = outputbuf->writep - bytes;
+			if (fade_start < outputbuf->buf) {
+				fade_start += outputbuf->size;
+			}
+			// the track starts with the crossfade
+			track->pos = fade_start;
+			_marker_fade(fade_start, FADE_CROSS, outputbuf->writep);
 		}
 	}
 }
 
+// set the fade curve by name, returning false if unknown
+bool output_fade_curve_set(const char *curve) {
+	unsigned i;
+	for (i = 0; i < sizeof(fade_curve_names) / sizeof(fade_curve_names[0]); ++i) {
+		if (!strcmp(curve, fade_curve_names[i])) {
+			output_fade_curve = i;
+			return true;
+		}
+	}
+	return false;
+}
+
 void output_init_common(log_level level, const char *device, unsigned output_buf_size, unsigned rates[], unsigned idle) {
 	unsigned i;
 
 	loglevel = level;
 
+	if (outputbuf_secs) {
+		output_buf_size = max(outputbuf_secs * 44100 * BYTES_PER_FRAME, OUTPUTBUF_SIZE_MIN);
+		if (outputbuf_z) {
+			// packed blocks are held in order of the address space so it is not resized
+			LOG_INFO("compressed outputbuf memory sized for %u seconds at 44100", outputbuf_secs);
+			outputbuf_secs = 0;
+		} else {
+			LOG_INFO("outputbuf sized for %u seconds, resized for each track's sample rate", outputbuf_secs);
+		}
+	}
+
 	output_buf_size = output_buf_size - (output_buf_size % BYTES_PER_FRAME);
+	outputbuf_base = outputbuf_target = outputbuf_sized = output_buf_size;
 	LOG_DEBUG("outputbuf size: %u", output_buf_size);
 
-	buf_init(outputbuf, output_buf_size);
+	if (outputbuf_z && !zbuf_init(level, outputbuf, output_buf_size)) {
+		LOG_WARN("compressed outputbuf not available");
+		outputbuf_z = false;
+	}
+	if (!outputbuf_z) {
+		buf_init(outputbuf, output_buf_size);
+	}
 	if (!outputbuf->buf) {
 		LOG_ERROR("unable to malloc output buffer");
 		exit(1);
 	}
+	LOG_INFO("outputbuf: %u bytes at %p" BUF_MEM_FMT, outputbuf->size, outputbuf->buf, BUF_MEM_ARGS(outputbuf->mem));
 
-	silencebuf = malloc(MAX_SILENCE_FRAMES * BYTES_PER_FRAME);
+	if (outputbuf_history) {
+		if (outputbuf_z) {
+			// played blocks are released once consumed
+			LOG_WARN("playback history not available with compressed outputbuf");
+		} else {
+			output.history_size = outputbuf_history * 44100 * BYTES_PER_FRAME;
+			LOG_INFO("retaining up to %u bytes of playback history", output.history_size);
+		}
+	}
+
+	silencebuf_size = MAX_SILENCE_FRAMES * BYTES_PER_FRAME;
+	silencebuf = buf_mem_alloc(&silencebuf_size, &silencebuf_mem);
 	if (!silencebuf) {
 		LOG_ERROR("unable to malloc silence buffer");
 		exit(1);
 	}
 	memset(silencebuf, 0, MAX_SILENCE_FRAMES * BYTES_PER_FRAME);
+	LOG_INFO("silencebuf: %u bytes at %p" BUF_MEM_FMT, silencebuf_size, silencebuf, BUF_MEM_ARGS(silencebuf_mem));
 
 	IF_DSD(
-		silencebuf_dsd = malloc(MAX_SILENCE_FRAMES * BYTES_PER_FRAME);
+		silencebuf_dsd_size = MAX_SILENCE_FRAMES * BYTES_PER_FRAME;
+		silencebuf_dsd = buf_mem_alloc(&silencebuf_dsd_size, &silencebuf_dsd_mem);
 		if (!silencebuf_dsd) {
 			LOG_ERROR("unable to malloc silence dsd buffer");
 			exit(1);
 		}
 		dsd_silence_frames((u32_t *)silencebuf_dsd, MAX_SILENCE_FRAMES);
+		LOG_INFO("silencebuf_dsd: %u bytes at %p" BUF_MEM_FMT, silencebuf_dsd_size, silencebuf_dsd, BUF_MEM_ARGS(silencebuf_dsd_mem));
 	)
 
+#if PACK_SIMD
+	LOG_INFO("pack kernels: %s", pack_simd_init(NULL));
+#endif
+
+	for (i = 0; i <= FADE_LUT; ++i) {
+		float x = (float)i / FADE_LUT;
+		switch (output_fade_curve) {
+		case FADE_POWER: x = sinf(x * 1.57079633F); break;
+		case FADE_LOG:   x = i ? powf(10.0F, -FADE_LOG_DB * (1.0F - x) / 20.0F) : 0; break;
+		default: break;
+		}
+		fade_lut[i] = to_gain(x);
+	}
+	fade_lut[FADE_LUT + 1] = fade_lut[FADE_LUT];
+	LOG_DEBUG("fade curve: %s", fade_curve_names[output_fade_curve]);
+
 	LOG_DEBUG("idle timeout: %u", idle);
 
 	output.state = idle ? OUTPUT_OFF: OUTPUT_STOPPED;
 	output.device = device;
 	output.fade = FADE_INACTIVE;
+	output.frame_bytes = output.next_frame_bytes = output.prev_frame_bytes = BYTES_PER_FRAME;
 	output.invert = false;
 	output.error_opening = false;
 	output.idle_to = (u32_t) idle;
@@ -428,17 +881,50 @@ void output_init_common(log_level level, const char *device, unsigned output_buf
 }
 
 void output_close_common(void) {
+	zbuf_close();
 	buf_destroy(outputbuf);
-	free(silencebuf);
+	buf_mem_free(silencebuf, silencebuf_size, silencebuf_mem);
 	IF_DSD(
-		free(silencebuf_dsd);
+		buf_mem_free(silencebuf_dsd, silencebuf_dsd_size, silencebuf_dsd_mem);
 	)
 }
 
+// release outputbuf and silencebuf memory while idle, outputbuf only if empty and not compressed as zbuf holds state
+// for its blocks, silencebuf reads back as zeros so may still be written by the output thread, silencebuf_dsd is kept
+// as it holds the dsd idle pattern rather than zeros and is small
+size_t output_release(void) {
+	size_t bytes;
+	LOCK;
+	bytes = buf_mem_release(silencebuf, silencebuf_size, &silencebuf_mem);
+	if (!outputbuf_z && !_buf_used(outputbuf) && !output.marker_count) {
+		output.history = 0;
+		bytes += _buf_release(outputbuf);
+	}
+	UNLOCK;
+	return bytes;
+}
+
+void output_reacquire(void) {
+	LOCK;
+	buf_mem_reacquire(silencebuf, silencebuf_size, &silencebuf_mem);
+	_buf_reacquire(outputbuf);
+	UNLOCK;
+}
+
+// called by controllers after changing output state so outputs sleeping until the device needs data respond promptly
+void wake_output(void) {
+	if (output.wake_cb) {
+		output.wake_cb();
+	}
+}
+
 void output_flush(void) {
 	LOG_INFO("flush output buffer (full)");
 	buf_flush(outputbuf);
 	LOCK;
+	_zbuf_flush();
+	output.marker_head = output.marker_count = 0;
+	output.history = 0;
 	output.fade = FADE_INACTIVE;
 	if (output.state != OUTPUT_OFF) {
 		output.state = OUTPUT_STOPPED;
@@ -449,17 +935,27 @@ void output_flush(void) {
 		output.delay_active = false;
 	}
 	output.frames_played = 0;
+	// all audio queued in the device may be dropped
+	output.tail_drop = true;
+	output.tail_frames = ~(frames_t)0;
 	UNLOCK;
+	wake_output();
 }
 
 bool output_flush_streaming(void) {
+	struct marker *m;
 	bool flushed;
 	LOG_INFO("flush output buffer (streaming)");
 	LOCK;
-	flushed = output.track_start != NULL;
-	if (output.track_start) {
-		outputbuf->writep = output.track_start;
-		output.track_start = NULL;
+	m = _marker_track();
+	flushed = m != NULL;
+	if (m) {
+		// discard the track being decoded and anything queued after its start
+		_zbuf_discard(m->pos);
+		store_release(outputbuf->writep, m->pos);
+		output.marker_count = (m - output.markers + OUTPUT_MARKERS - output.marker_head) % OUTPUT_MARKERS;
+		m = _marker_track();
+		output.next_frame_bytes = m ? m->frame_bytes : output.frame_bytes;
 	}
 	UNLOCK;
 	return flushed;
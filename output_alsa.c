@@ -29,21 +29,28 @@
 #if ALSA
 
 #include <alsa/asoundlib.h>
-#include <sys/mman.h>
-#include <malloc.h>
 #include <math.h>
+#if LINUX
+#include <sys/timerfd.h>
+#define TSCHED 1
+#else
+#define TSCHED 0
+#endif
 
 #define MAX_DEVICE_LEN 128
+#define MAX_KEY_LEN    512
+#define MAX_POLL_FDS   8   // descriptors polled for the device, plugins chaining several devices may need more than one
 
-static snd_pcm_format_t fmts[] = { SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_S16_LE,
-								   SND_PCM_FORMAT_UNKNOWN };
-
-#if SL_LITTLE_ENDIAN
-#define NATIVE_FORMAT SND_PCM_FORMAT_S32_LE
+#if SELFPIPE
+#define WAKE_FD(e) (e).fds[0]
 #else
-#define NATIVE_FORMAT SND_PCM_FORMAT_S32_BE
+#define WAKE_FD(e) (e)
 #endif
 
+// float is probed last, after the integer formats which carry the full sample
+static snd_pcm_format_t fmts[] = { SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_S16_LE,
+								   SND_PCM_FORMAT_FLOAT_LE, SND_PCM_FORMAT_UNKNOWN };
+
 // ouput device
 static struct {
 	char device[MAX_DEVICE_LEN + 1];
@@ -59,7 +66,12 @@ static struct {
 	unsigned rate;
 	bool mmap;
 	bool reopen;
+	bool tstamp;
+	unsigned open_us;      // time the last full open of the device took, compared against rate switches keeping it open
+	unsigned tsched;       // refill on a timer this many ms before the device buffer empties, 0 to refill each period
+	int timer_fd;
 	u8_t *write_buf;
+	snd_pcm_uframes_t write_buf_frames;
 	const char *volume_mixer_name;
 	bool mixer_linear;
 	snd_mixer_elem_t* mixer_elem;
@@ -70,6 +82,35 @@ static struct {
 
 static snd_pcm_t *pcmp = NULL;
 
+// further devices fed the same frames as the output device from the one outputbuf, each packed to its own format and
+// kept aligned to the output device by comparing delays, correcting a frame at a time for drift between their clocks
+#define MAX_SLAVES        4
+#define SLAVE_SLIP_FRAMES 8        // average delay error corrected beyond this, as usb delays jitter by a packet
+
+static struct alsa_slave {
+	char device[MAX_DEVICE_LEN + 1];
+	snd_pcm_format_t req_format;   // format requested, 0 for the first supported
+	int trim_us;                   // played this much later than the output device, earlier if negative
+	snd_pcm_t *pcm;
+	snd_pcm_format_t format;
+	output_format outfmt;
+	struct pack_spec pack;
+	unsigned frame_bytes;          // packed bytes per frame
+	u8_t *buf;
+	snd_pcm_uframes_t buf_frames;
+	snd_pcm_sframes_t trim;        // trim_us in frames at the rate opened
+	snd_pcm_sframes_t slip;        // correction for the next write, frames dropped if positive or added if negative
+	s32_t err_avg;                 // average delay error against the output device, frames << 4
+	u64_t written;
+	s64_t drift;                   // frames corrected a frame at a time since opened, for the drift estimate
+	u64_t logged;
+} slaves[MAX_SLAVES];
+
+static unsigned slave_count = 0;
+
+// signalled by controllers changing output state so the output thread wakes without polling
+static event_event wake_e;
+
 extern u8_t *silencebuf;
 #if DSD
 extern u8_t *silencebuf_dsd;
@@ -81,6 +122,7 @@ static bool running = true;
 
 extern struct outputstate output;
 extern struct buffer *outputbuf;
+extern struct decodestate decode;
 
 #define LOCK   mutex_lock(outputbuf->mutex)
 #define UNLOCK mutex_unlock(outputbuf->mutex)
@@ -235,6 +277,8 @@ void set_volume(unsigned left, unsigned right) {
 		output.gainL = left;
 		output.gainR = right;
 		UNLOCK;
+		// audio queued in the device is rewound and replayed at the new gain when refilling on a timer
+		wake_output();
 		return;
 	} else {
 		LOCK;
@@ -269,13 +313,143 @@ static void alsa_close(void) {
 	}
 }
 
+// probed rates cached on disk so startup need not open the device, each line holds a key identifying the device and its
+// card followed by a tab and the comma separated rates
+char *rates_cache = NULL;
+static char rates_key[MAX_KEY_LEN];
+static bool rates_cached = false;  // supported rates were read from the cache, reprobed if the device fails to open
+
+// key the cache by device name, card id and name, usb vid:pid and the formats, channels and rates the usb descriptors
+// advertise, so a replaced device or new firmware is probed again - the card is found from its control device which
+// opens without touching the pcm
+static bool rates_cache_key(const char *device) {
+	snd_ctl_t *ctl;
+	snd_ctl_card_info_t *info;
+	char *ctl_name = ctl4device(device);
+	char path[64], line[256], usbid[32] = "";
+	u32_t hash = 2166136261U;
+	int card, err;
+	FILE *fp;
+
+	snd_ctl_card_info_alloca(&info);
+
+	err = snd_ctl_open(&ctl, ctl_name, 0);
+	free(ctl_name);
+	if (err < 0) {
+		return false;
+	}
+	if ((err = snd_ctl_card_info(ctl, info)) < 0) {
+		snd_ctl_close(ctl);
+		return false;
+	}
+	card = snd_ctl_card_info_get_card(info);
+
+	sprintf(path, "/proc/asound/card%d/usbid", card);
+	if ((fp = fopen(path, "r"))) {
+		if (fgets(usbid, sizeof(usbid), fp)) {
+			usbid[strcspn(usbid, "\n")] = '\0';
+		}
+		fclose(fp);
+	}
+
+	// fnv-1a of the descriptor derived lines, not the stream status which changes while playing
+	sprintf(path, "/proc/asound/card%d/stream0", card);
+	if ((fp = fopen(path, "r"))) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (strstr(line, "Format:") || strstr(line, "Channels:") || strstr(line, "Rates:")) {
+				char *c;
+				for (c = line; *c; ++c) {
+					hash = (hash ^ (u8_t)*c) * 16777619U;
+				}
+			}
+		}
+		fclose(fp);
+	}
+
+	snprintf(rates_key, sizeof(rates_key), "%s|%s|%s|%s|%08x", device, snd_ctl_card_info_get_id(info),
+			 snd_ctl_card_info_get_longname(info), usbid, hash);
+	snd_ctl_close(ctl);
+
+	// tabs and newlines delimit the cache
+	for (ctl_name = rates_key; *ctl_name; ++ctl_name) {
+		if (*ctl_name == '\t' || *ctl_name == '\n') *ctl_name = ' ';
+	}
+	return true;
+}
+
+static bool rates_cache_read(unsigned rates[]) {
+	char line[MAX_KEY_LEN + 16 * MAX_SUPPORTED_SAMPLERATES];
+	size_t len = strlen(rates_key);
+	bool found = false;
+	FILE *fp;
+
+	if (!(fp = fopen(rates_cache, "r"))) {
+		return false;
+	}
+	while (!found && fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, rates_key, len) && line[len] == '\t') {
+			char *r = next_param(line + len + 1, ',');
+			unsigned i = 0;
+			while (r && i < MAX_SUPPORTED_SAMPLERATES - 1) {
+				if (atoi(r)) rates[i++] = atoi(r);
+				r = next_param(NULL, ',');
+			}
+			found = i > 0;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+
+// replace the line for this key, or remove it when rates is NULL - written to a temporary file and renamed so instances
+// sharing the cache never read a partial file, a concurrent update may be lost and is probed again at the next start
+static void rates_cache_write(const unsigned rates[]) {
+	char line[MAX_KEY_LEN + 16 * MAX_SUPPORTED_SAMPLERATES];
+	char tmp[PATH_MAX];
+	size_t len = strlen(rates_key);
+	FILE *in, *out;
+	unsigned i;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", rates_cache, getpid());
+	if (!(out = fopen(tmp, "w"))) {
+		LOG_WARN("unable to write rates cache: %s %s", tmp, strerror(errno));
+		return;
+	}
+	if ((in = fopen(rates_cache, "r"))) {
+		while (fgets(line, sizeof(line), in)) {
+			if (strncmp(line, rates_key, len) || line[len] != '\t') {
+				fputs(line, out);
+			}
+		}
+		fclose(in);
+	}
+	if (rates) {
+		fprintf(out, "%s\t", rates_key);
+		for (i = 0; i < MAX_SUPPORTED_SAMPLERATES && rates[i]; ++i) {
+			fprintf(out, i ? ",%u" : "%u", rates[i]);
+		}
+		fputc('\n', out);
+	}
+	if (fclose(out) != 0 || rename(tmp, rates_cache) != 0) {
+		LOG_WARN("unable to write rates cache: %s %s", rates_cache, strerror(errno));
+		unlink(tmp);
+	}
+}
+
 bool test_open(const char *device, unsigned rates[], bool userdef_rates) {
 	int err;
 	snd_pcm_t *pcm;
 	snd_pcm_hw_params_t *hw_params;
+	bool cache = rates_cache && !userdef_rates && rates_cache_key(device);
 	hw_params = (snd_pcm_hw_params_t *) alloca(snd_pcm_hw_params_sizeof());
 	memset(hw_params, 0, snd_pcm_hw_params_sizeof());
 
+	if (cache && rates_cache_read(rates)) {
+		LOG_INFO("using cached rates for %s", rates_key);
+		rates_cached = true;
+		return true;
+	}
+
 	// open device
 	if ((err = snd_pcm_open(&pcm, device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
 		LOG_ERROR("playback open error: %s", snd_strerror(err));
@@ -308,9 +482,29 @@ bool test_open(const char *device, unsigned rates[], bool userdef_rates) {
 		return false;
 	}
 
+	if (cache && rates[0]) {
+		rates_cache_write(rates);
+	}
+
 	return true;
 }
 
+// cached rates are only checked when the device first fails to open - its entry is removed and the device probed
+// again, so the cache is rewritten if it opens and otherwise probed at the next start
+static void rates_revalidate(void) {
+	unsigned rates[MAX_SUPPORTED_SAMPLERATES] = { 0 };
+
+	rates_cached = false;
+	rates_cache_write(NULL);
+
+	if (test_open(output.device, rates, false)) {
+		LOCK;
+		memcpy(output.supported_rates, rates, sizeof(rates));
+		UNLOCK;
+		LOG_INFO("reprobed rates for %s, max: %u", output.device, rates[0]);
+	}
+}
+
 static bool pcm_probe(const char *device) {
 	int err;
 	snd_pcm_t *pcm;
@@ -326,17 +520,57 @@ static bool pcm_probe(const char *device) {
 	return true;
 }
 
+// output format packed by _scale_and_pack for an alsa format
+static bool pcm_output_format(snd_pcm_format_t format, output_format *out) {
+	switch(format) {
+	case SND_PCM_FORMAT_S32_LE:
+		*out = S32_LE; break;
+	case SND_PCM_FORMAT_S24_LE: 
+		*out = S24_LE; break;
+	case SND_PCM_FORMAT_S24_3LE:
+		*out = S24_3LE; break;
+	case SND_PCM_FORMAT_S16_LE: 
+		*out = S16_LE; break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		*out = FLOAT_LE; break;
 #if DSD
-static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buffer, unsigned alsa_period, dsd_format outfmt) {
+	case SND_PCM_FORMAT_DSD_U32_LE:
+		*out = U32_LE; break;
+	case SND_PCM_FORMAT_DSD_U32_BE:
+		*out = U32_BE; break;
+	case SND_PCM_FORMAT_DSD_U16_LE:
+		*out = U16_LE; break;
+	case SND_PCM_FORMAT_DSD_U16_BE:
+		*out = U16_BE; break;
+	case SND_PCM_FORMAT_DSD_U8:
+		*out = U8; break;
+#endif
+	default: 
+		return false;
+	}
+	return true;
+}
+
+// alsa format for a sample format param, 0 if not known
+static snd_pcm_format_t pcm_format_param(const char *param) {
+	if (!strcmp(param, "32")) return SND_PCM_FORMAT_S32_LE;
+	if (!strcmp(param, "24")) return SND_PCM_FORMAT_S24_LE;
+	if (!strcmp(param, "24_3")) return SND_PCM_FORMAT_S24_3LE;
+	if (!strcmp(param, "16")) return SND_PCM_FORMAT_S16_LE;
+	if (!strcmp(param, "float")) return SND_PCM_FORMAT_FLOAT_LE;
+	return 0;
+}
+
+#if DSD
+static int alsa_setup(const char *device, unsigned sample_rate, unsigned alsa_buffer, unsigned alsa_period, dsd_format outfmt) {
 #else
-static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buffer, unsigned alsa_period) {
+static int alsa_setup(const char *device, unsigned sample_rate, unsigned alsa_buffer, unsigned alsa_period) {
 #endif
 	int err;
 	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_sw_params_t *sw_params;
 	snd_pcm_hw_params_alloca(&hw_params);
-
-	// close if already open
-	if (pcmp) alsa_close();
+	snd_pcm_sw_params_alloca(&sw_params);
 
 	// reset params
 	alsa.rate = 0;
@@ -351,12 +585,13 @@ static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buf
 		return -1;
 	}
 
-	LOG_INFO("opening device at: %u", sample_rate);
+	LOG_INFO("%s device at: %u", pcmp ? "configuring" : "opening", sample_rate);
 
 	bool retry;
 	do {
-		// open device
-		if ((err = snd_pcm_open(&pcmp, alsa.device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+		// open device, unless its handle is kept with hw params freed
+		if (!pcmp && (err = snd_pcm_open(&pcmp, alsa.device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+			pcmp = NULL;
 			LOG_ERROR("playback open error: %s", snd_strerror(err));
 			return err;
 		}
@@ -383,6 +618,7 @@ static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buf
 				memcpy(alsa.device, "plug", 4);
 				LOG_INFO("reopening device %s in plug mode as %s for resampling", device, alsa.device);
 				snd_pcm_close(pcmp);
+				pcmp = NULL;
 				retry = true;
 			}
 		}
@@ -415,11 +651,21 @@ static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buf
 		alsa.format = SND_PCM_FORMAT_S24_LE; break;
 	case DOP_S24_3LE:
 		alsa.format = SND_PCM_FORMAT_S24_3LE; break;
+	case DOP:
+		// dop markers must reach the dac bit exact so are not sent as float, probe integer formats instead
+		alsa.format = alsa.pcmfmt == SND_PCM_FORMAT_FLOAT_LE ? 0 : alsa.pcmfmt; break;
 	default:
 		alsa.format = alsa.pcmfmt;
 	}
 #endif
 	snd_pcm_format_t *fmt = alsa.format ? &alsa.format : (snd_pcm_format_t *)fmts;
+	// dop is only probed with the integer formats
+	snd_pcm_format_t end = SND_PCM_FORMAT_UNKNOWN;
+#if DSD
+	if (outfmt == DOP) {
+		end = SND_PCM_FORMAT_FLOAT_LE;
+	}
+#endif
 	do {
 		if (snd_pcm_hw_params_set_format(pcmp, hw_params, *fmt) >= 0) {
 			LOG_INFO("opened device %s using format: %s sample rate: %u mmap: %u", alsa.device, snd_pcm_format_name(*fmt), sample_rate, alsa.mmap);
@@ -431,37 +677,14 @@ static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buf
 			return -1;
 		}
 		++fmt; 
-		if (*fmt == SND_PCM_FORMAT_UNKNOWN) {
+		if (*fmt == SND_PCM_FORMAT_UNKNOWN || *fmt == end) {
 			LOG_ERROR("unable to open audio device with any supported format");
 			return -1;
 		}
 	} while (*fmt != SND_PCM_FORMAT_UNKNOWN);
 
 	// set the output format to be used by _scale_and_pack
-	switch(alsa.format) {
-	case SND_PCM_FORMAT_S32_LE:
-		output.format = S32_LE; break;
-	case SND_PCM_FORMAT_S24_LE: 
-		output.format = S24_LE; break;
-	case SND_PCM_FORMAT_S24_3LE:
-		output.format = S24_3LE; break;
-	case SND_PCM_FORMAT_S16_LE: 
-		output.format = S16_LE; break;
-#if DSD
-	case SND_PCM_FORMAT_DSD_U32_LE:
-		output.format = U32_LE; break;
-	case SND_PCM_FORMAT_DSD_U32_BE:
-		output.format = U32_BE; break;
-	case SND_PCM_FORMAT_DSD_U16_LE:
-		output.format = U16_LE; break;
-	case SND_PCM_FORMAT_DSD_U16_BE:
-		output.format = U16_BE; break;
-	case SND_PCM_FORMAT_DSD_U8:
-		output.format = U8; break;
-#endif
-	default: 
-		break;
-	}
+	pcm_output_format(alsa.format, &output.format);
 
 	// set channels
 	if ((err = snd_pcm_hw_params_set_channels (pcmp, hw_params, 2)) < 0) {
@@ -485,8 +708,9 @@ static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buf
 		}
 	}
 
-	// set buffer size - value of < 500 treated as buffer time in ms, otherwise size in bytes
-	if (alsa_buffer < 500) {
+	// set buffer size - value of < 500 treated as buffer time in ms, otherwise size in bytes, always time when refilling
+	// on a timer as the buffer is expected to be seconds long
+	if (alsa_buffer < 500 || alsa.tsched) {
 		unsigned time = alsa_buffer * 1000;
 		int dir = 0;
 		if ((err = snd_pcm_hw_params_set_buffer_time_near(pcmp, hw_params, &time, &dir)) < 0) {
@@ -515,25 +739,61 @@ static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buf
 
 	LOG_INFO("buffer: %u period: %u -> buffer size: %u period size: %u", alsa_buffer, alsa_period, alsa.buffer_size, alsa.period_size);
 
-	// ensure we have two buffer sizes of samples before starting output
+	// ensure we have two buffer sizes of samples before starting output, or twice the refill margin when refilling on
+	// a timer as a buffer of seconds may be larger than outputbuf
 	output.start_frames = alsa.buffer_size * 2;
+#if TSCHED
+	if (alsa.tsched) {
+		output.start_frames = min((snd_pcm_uframes_t)alsa.tsched * sample_rate / 1000, alsa.buffer_size / 2) * 2;
+	}
+#endif
 
-	// create an intermediate buffer for non mmap case for all but NATIVE_FORMAT
-	// this is used to pack samples into the output format before calling writei
-	if (!alsa.mmap && !alsa.write_buf && alsa.format != NATIVE_FORMAT) {
+	// create an intermediate buffer for non mmap case, this is used to pack samples into the output format before
+	// calling writei, sized for the buffer, which grows with the sample rate when set as a time
+	if (!alsa.mmap && (!alsa.write_buf || alsa.buffer_size > alsa.write_buf_frames)) {
+		free(alsa.write_buf);
 		alsa.write_buf = malloc(alsa.buffer_size * BYTES_PER_FRAME);
+		alsa.write_buf_frames = alsa.buffer_size;
 		if (!alsa.write_buf) {
 			LOG_ERROR("unable to malloc write_buf");
 			return -1;
 		}
 	}
 
+#if TSCHED
+	// timer scheduling - the device need not interrupt each period as the thread sleeps until the buffer is nearly empty
+	if (alsa.tsched) {
+		if (snd_pcm_hw_params_can_disable_period_wakeup(hw_params) &&
+			snd_pcm_hw_params_set_period_wakeup(pcmp, hw_params, 0) == 0) {
+			LOG_INFO("period wakeups disabled, refilling %u ms before the buffer empties", alsa.tsched);
+		} else {
+			LOG_INFO("unable to disable period wakeups, refilling %u ms before the buffer empties", alsa.tsched);
+		}
+	}
+#endif
+
 	// set params
 	if ((err = snd_pcm_hw_params(pcmp, hw_params)) < 0) {
 		LOG_ERROR("unable to set hw params: %s", snd_strerror(err));
 		return err;
 	}
 
+	// timestamp the device position on the clock of gettime_ms so timed starts can be sized against it
+	alsa.tstamp = false;
+#if SND_LIB_VERSION >= 0x01001c
+	if ((err = snd_pcm_sw_params_current(pcmp, sw_params)) < 0 ||
+		(alsa.tsched && (err = snd_pcm_sw_params_set_period_event(pcmp, sw_params, 0)) < 0) ||
+		(err = snd_pcm_sw_params_set_tstamp_mode(pcmp, sw_params, SND_PCM_TSTAMP_ENABLE)) < 0 ||
+#ifdef CLOCK_MONOTONIC
+		(err = snd_pcm_sw_params_set_tstamp_type(pcmp, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0 ||
+#endif
+		(err = snd_pcm_sw_params(pcmp, sw_params)) < 0) {
+		LOG_DEBUG("unable to set sw params, timestamps disabled: %s", snd_strerror(err));
+	} else {
+		alsa.tstamp = true;
+	}
+#endif
+
 	// dump info
 	if (loglevel == lSDEBUG) {
 		static snd_output_t *debug_output;
@@ -550,13 +810,329 @@ static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buf
 	return 0;
 }
 
+// open the device for a new rate or format - where the device was opened by name without a plug conversion the handle
+// is kept and only its hw params renegotiated, which on many usb dacs is several times quicker than closing and opening
+// it again, falling back to a full reopen if that fails
+// the time taken is measured and logged against the last full reopen, the configured rate_delay is left as set as the
+// device may still need it to settle on the new rate
+#if DSD
+static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buffer, unsigned alsa_period, dsd_format outfmt) {
+#else
+static int alsa_open(const char *device, unsigned sample_rate, unsigned alsa_buffer, unsigned alsa_period) {
+#endif
+	u64_t start = gettime_us();
+	unsigned took;
+	int err;
+
+	if (pcmp && !alsa.reopen && !strcmp(alsa.device, device)) {
+		snd_pcm_drop(pcmp);
+		if ((err = snd_pcm_hw_free(pcmp)) == 0 &&
+#if DSD
+			(err = alsa_setup(device, sample_rate, alsa_buffer, alsa_period, outfmt)) == 0) {
+#else
+			(err = alsa_setup(device, sample_rate, alsa_buffer, alsa_period)) == 0) {
+#endif
+			took = (unsigned)(gettime_us() - start);
+			LOG_INFO("rate switch kept device open: %u us, saved %u us against full reopen: %u us", took,
+					 alsa.open_us > took ? alsa.open_us - took : 0, alsa.open_us);
+			return 0;
+		}
+		LOG_INFO("unable to reconfigure open device, reopening: %s", snd_strerror(err));
+		start = gettime_us();
+	}
+
+	// close if already open
+	if (pcmp) {
+		alsa_close();
+		pcmp = NULL;
+	}
+
+#if DSD
+	if ((err = alsa_setup(device, sample_rate, alsa_buffer, alsa_period, outfmt)) == 0) {
+#else
+	if ((err = alsa_setup(device, sample_rate, alsa_buffer, alsa_period)) == 0) {
+#endif
+		alsa.open_us = (unsigned)(gettime_us() - start);
+		LOG_INFO("device opened: %u us", alsa.open_us);
+	}
+
+	return err;
+}
+
+// add a device fed alongside the output device, arg is <device>[@<trim ms>[@<format>]], called before output_init_alsa
+bool alsa_add_device(const char *arg) {
+	struct alsa_slave *sl = &slaves[slave_count];
+	char *params, *d, *t, *f;
+	bool ok;
+
+	if (slave_count == MAX_SLAVES || !(params = strdup(arg))) {
+		return false;
+	}
+	d = next_param(params, '@');
+	t = next_param(NULL, '@');
+	f = next_param(NULL, '@');
+
+	memset(sl, 0, sizeof(*sl));
+	ok = d && strlen(d) <= MAX_DEVICE_LEN - 4 - 1;
+	if (ok) {
+		strcpy(sl->device, d);
+		sl->trim_us = t ? (int)(atof(t) * 1000) : 0;
+		ok = !f || (sl->req_format = pcm_format_param(f)) != 0;
+	}
+	free(params);
+
+	if (ok) {
+		++slave_count;
+	}
+	return ok;
+}
+
+// open a slave at the rate and depth of the output device, hw: devices are reopened as plughw: to resample rates they
+// do not support as for the output device - writes do not block so a slave can not stall the output device, and it is
+// started with the output device rather than when first written
+static void slave_open(struct alsa_slave *sl) {
+	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_sw_params_t *sw_params;
+	snd_pcm_uframes_t buffer_size = alsa.buffer_size, period_size = alsa.period_size, boundary;
+	snd_pcm_format_t *fmt;
+	char name[MAX_DEVICE_LEN + 1];
+	bool retry;
+	int err;
+
+	snd_pcm_hw_params_alloca(&hw_params);
+	snd_pcm_sw_params_alloca(&sw_params);
+
+	strcpy(name, sl->device);
+	do {
+		retry = false;
+		if ((err = snd_pcm_open(&sl->pcm, name, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) < 0) {
+			LOG_WARN("unable to open %s: %s", name, snd_strerror(err));
+			sl->pcm = NULL;
+			return;
+		}
+		if ((err = snd_pcm_hw_params_any(sl->pcm, hw_params)) >= 0 &&
+			(err = snd_pcm_hw_params_set_rate(sl->pcm, hw_params, alsa.rate, 0)) < 0 && !strncmp(name, "hw:", 3)) {
+			snd_pcm_close(sl->pcm);
+			sprintf(name, "plug%s", sl->device);
+			retry = true;
+		}
+	} while (retry);
+
+	if (err < 0 ||
+		(err = snd_pcm_hw_params_set_access(sl->pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+		(err = snd_pcm_hw_params_set_channels(sl->pcm, hw_params, 2)) < 0) {
+		goto fail;
+	}
+
+	sl->format = SND_PCM_FORMAT_UNKNOWN;
+	for (fmt = sl->req_format ? &sl->req_format : fmts; *fmt != SND_PCM_FORMAT_UNKNOWN; ++fmt) {
+		if (snd_pcm_hw_params_set_format(sl->pcm, hw_params, *fmt) >= 0) {
+			sl->format = *fmt;
+			break;
+		}
+		if (sl->req_format) {
+			break;
+		}
+	}
+	if (sl->format == SND_PCM_FORMAT_UNKNOWN || !pcm_output_format(sl->format, &sl->outfmt)) {
+		err = -EINVAL;
+		goto fail;
+	}
+
+	if ((err = snd_pcm_hw_params_set_period_size_near(sl->pcm, hw_params, &period_size, NULL)) < 0 ||
+		(err = snd_pcm_hw_params_set_buffer_size_near(sl->pcm, hw_params, &buffer_size)) < 0 ||
+		(err = snd_pcm_hw_params(sl->pcm, hw_params)) < 0 ||
+		(err = snd_pcm_sw_params_current(sl->pcm, sw_params)) < 0 ||
+		(err = snd_pcm_sw_params_get_boundary(sw_params, &boundary)) < 0 ||
+		(err = snd_pcm_sw_params_set_start_threshold(sl->pcm, sw_params, boundary)) < 0 ||
+		(err = snd_pcm_sw_params(sl->pcm, sw_params)) < 0) {
+		goto fail;
+	}
+
+	// chunks written to the output device are at most its buffer
+	if (sl->buf_frames < alsa.buffer_size) {
+		free(sl->buf);
+		if (!(sl->buf = malloc(alsa.buffer_size * BYTES_PER_FRAME))) {
+			sl->buf_frames = 0;
+			err = -ENOMEM;
+			goto fail;
+		}
+		sl->buf_frames = alsa.buffer_size;
+	}
+
+	sl->frame_bytes = snd_pcm_frames_to_bytes(sl->pcm, 1);
+	sl->trim = (snd_pcm_sframes_t)sl->trim_us * (snd_pcm_sframes_t)alsa.rate / 1000000;
+	sl->slip = -sl->trim;
+	sl->err_avg = 0;
+	sl->written = sl->logged = 0;
+	sl->drift = 0;
+	sl->pack.pack = NULL;
+
+	if (buffer_size < alsa.buffer_size + max(sl->trim, 0)) {
+		LOG_WARN("%s buffer size %u is less than the output device, trims and delays beyond it are not matched",
+				 name, buffer_size);
+	}
+	LOG_INFO("opened %s using format: %s sample rate: %u buffer size: %u trim: %d frames", name,
+			 snd_pcm_format_name(sl->format), alsa.rate, buffer_size, (int)sl->trim);
+	return;
+
+ fail:
+	LOG_WARN("unable to configure %s: %s", name, snd_strerror(err));
+	snd_pcm_close(sl->pcm);
+	sl->pcm = NULL;
+}
+
+static void slaves_close(void) {
+	unsigned i;
+	for (i = 0; i < slave_count; ++i) {
+		if (slaves[i].pcm) {
+			snd_pcm_close(slaves[i].pcm);
+			slaves[i].pcm = NULL;
+		}
+	}
+}
+
+// (re)open slaves once the output device is opened, not for dsd which is only sent to the output device
+static void slaves_open(void) {
+	unsigned i;
+	slaves_close();
+#if DSD
+	if (alsa.outfmt != PCM) {
+		if (slave_count) LOG_INFO("dsd output, further devices closed");
+		return;
+	}
+#endif
+	for (i = 0; i < slave_count; ++i) {
+		slave_open(&slaves[i]);
+	}
+}
+
+// start prepared slaves once the output device runs, so both play the frames first written to them together
+static void slaves_start(void) {
+	unsigned i;
+	int err;
+	if (!slave_count || snd_pcm_state(pcmp) != SND_PCM_STATE_RUNNING) {
+		return;
+	}
+	for (i = 0; i < slave_count; ++i) {
+		if (slaves[i].pcm && snd_pcm_state(slaves[i].pcm) == SND_PCM_STATE_PREPARED &&
+			(err = snd_pcm_start(slaves[i].pcm)) < 0) {
+			LOG_DEBUG("unable to start %s: %s", slaves[i].device, snd_strerror(err));
+		}
+	}
+}
+
+// called with mutex locked once out_frames were written to the output device from inputptr, which is not processed in
+// place while slaves are open - the same frames are packed for each slave and written, then its delay compared with the
+// output device: errors of more than a period (start, xruns) are corrected at once by dropping frames or adding silence,
+// drift between the device clocks is averaged and corrected by dropping or repeating a frame
+static void _slaves_write(frames_t out_frames, bool silence, s32_t *inputptr, s32_t gainL, s32_t gainR, u8_t flags,
+						  const struct cross_mix *cross, const struct gain_ramp *ramp) {
+	bool narrow = !silence && output.frame_bytes != BYTES_PER_FRAME;
+	bool unity = gainL == FIXED_ONE && gainR == FIXED_ONE &&
+		!(ramp && (ramp->stepL || ramp->stepR || ramp->step_in || ramp->step_out));
+	snd_pcm_sframes_t delay, sdelay, w, err;
+	bool aligned = snd_pcm_delay(pcmp, &delay) == 0;
+	unsigned i;
+
+	for (i = 0; i < slave_count; ++i) {
+		struct alsa_slave *sl = &slaves[i];
+		u8_t *out = sl->buf;
+		snd_pcm_sframes_t frames = out_frames;
+
+		if (!sl->pcm) {
+			continue;
+		}
+
+		if (silence) {
+			// zero in every pcm format
+			out = silencebuf;
+		} else if (narrow && !cross) {
+			_scale_and_pack_frames16(out, (s16_t *)(void *)inputptr, frames, gainL, gainR, flags, sl->outfmt, ramp);
+		} else {
+			struct cross_mix c;
+			if (cross) {
+				c = *cross;
+			}
+			if (_pack_select(&sl->pack, sl->outfmt, flags, unity)) {
+				LOG_DEBUG("%s pack: %s flags: 0x%x gain: %s", sl->device, sl->pack.name, sl->pack.flags,
+						  sl->pack.unity ? "unity" : "scaled");
+			}
+			_scale_and_pack_fused(&sl->pack, out, inputptr, frames, gainL, gainR, outputbuf, cross ? &c : NULL, ramp);
+		}
+
+		if (sl->slip > 0) {
+			snd_pcm_sframes_t drop = min(sl->slip, frames);
+			out += drop * sl->frame_bytes;
+			frames -= drop;
+			sl->slip -= drop;
+		}
+		while (sl->slip < 0) {
+			// a single frame is repeated, larger corrections are silence
+			bool repeat = sl->slip == -1;
+			w = snd_pcm_writei(sl->pcm, repeat ? out : silencebuf, repeat ? 1 : min(-sl->slip, MAX_SILENCE_FRAMES));
+			if (w <= 0) {
+				// kept for the next write
+				break;
+			}
+			sl->slip += w;
+		}
+
+		w = frames ? snd_pcm_writei(sl->pcm, out, frames) : 0;
+		if (w < 0) {
+			if (w != -EAGAIN && (err = snd_pcm_recover(sl->pcm, w, 1)) < 0) {
+				LOG_WARN("closing %s: %s", sl->device, snd_strerror(err));
+				snd_pcm_close(sl->pcm);
+				sl->pcm = NULL;
+				continue;
+			}
+			w = 0;
+		}
+
+		// frames not taken by a short write are made up with silence
+		sl->slip -= frames - w;
+		sl->written += w;
+
+		if (!aligned || snd_pcm_delay(sl->pcm, &sdelay) < 0) {
+			continue;
+		}
+
+		err = sdelay - delay - sl->trim;
+		if (err > (snd_pcm_sframes_t)alsa.period_size || err < -(snd_pcm_sframes_t)alsa.period_size) {
+			LOG_DEBUG("%s realigning by %d frames", sl->device, (int)err);
+			sl->slip = err;
+			sl->err_avg = 0;
+		} else {
+			sl->err_avg += ((s32_t)err * 16 - sl->err_avg) / 64;
+			if (sl->err_avg > SLAVE_SLIP_FRAMES * 16) {
+				sl->slip += 1;
+				sl->err_avg -= 16;
+				sl->drift += 1;
+			} else if (sl->err_avg < -SLAVE_SLIP_FRAMES * 16) {
+				sl->slip -= 1;
+				sl->err_avg += 16;
+				sl->drift -= 1;
+			}
+		}
+
+		if (sl->written - sl->logged >= (u64_t)alsa.rate * 60) {
+			LOG_INFO("%s drift: %d ppm", sl->device, (int)(sl->drift * 1000000 / (s64_t)sl->written));
+			sl->logged = sl->written;
+		}
+	}
+
+	slaves_start();
+}
+
 static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
-						 s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr) {
+						 struct cross_mix *cross, const struct gain_ramp *ramp) {
 
 	const snd_pcm_channel_area_t *areas;
 	snd_pcm_uframes_t offset;
 	void  *outputptr;
 	s32_t *inputptr;
+	bool narrow = !silence && output.frame_bytes != BYTES_PER_FRAME;
+	struct cross_mix slave_cross;
 	int err;
 
 	if (alsa.mmap) {
@@ -572,40 +1148,38 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 		out_frames = (frames_t)alsa_frames;
 	}
 
-	if (!silence) {
-		// applying cross fade is delayed until this point as mmap_begin can change out_frames
-		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
-			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
-		}
+	// cross fade, dop markers / dsd invert, mono flags and gain are applied in one pass with packing by the pack
+	// selected for this chunk in output.pack, delayed until this point as mmap_begin can change out_frames
+	if (silence) {
+		cross = NULL;
 	}
 
 	inputptr = (s32_t *) (silence ? silencebuf : outputbuf->readp);
 
+	// packing for the output device advances the crossfade, so slaves start from a copy
+	if (cross && slave_count) {
+		slave_cross = *cross;
+	}
+
 	IF_DSD(
-		if (output.outfmt != PCM) {
-			if (silence) {
-				inputptr = (s32_t *) silencebuf_dsd;
+		if (output.outfmt != PCM && silence) {
+			inputptr = (s32_t *) silencebuf_dsd;
+			if (flags & DSD_DOP) {
+				update_dop((u32_t *) inputptr, out_frames, false); // don't invert silence
 			}
-			if (output.outfmt == DOP || output.outfmt == DOP_S24_LE || output.outfmt == DOP_S24_3LE)
-				update_dop((u32_t *) inputptr, out_frames, output.invert && !silence);
-			else if (output.invert && !silence)
-				dsd_invert((u32_t *) inputptr, out_frames);
 		}
 	)
 
-	if (alsa.mmap || alsa.format != NATIVE_FORMAT) {
-
-		outputptr = alsa.mmap ? (areas[0].addr + (areas[0].first + offset * areas[0].step) / 8) : alsa.write_buf;
-
-		_scale_and_pack_frames(outputptr, inputptr, out_frames, gainL, gainR, flags, output.format);
+	// always packed to the device or write_buf, never processed in place, so outputbuf is left unmodified for replay from
+	// history, rewinds when refilling on a timer and further devices
+	outputptr = alsa.mmap ? (areas[0].addr + (areas[0].first + offset * areas[0].step) / 8) : alsa.write_buf;
 
+	if (narrow && !cross) {
+		_scale_and_pack_frames16(outputptr, (s16_t *)(void *)inputptr, out_frames, gainL, gainR, flags, output.format, ramp);
+	} else if (!silence) {
+		_scale_and_pack_fused(&output.pack, outputptr, inputptr, out_frames, gainL, gainR, outputbuf, cross, ramp);
 	} else {
-
-		outputptr = (void *)inputptr;
-
-		if (!silence) {
-			_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
-		}
+		_scale_and_pack_frames(outputptr, inputptr, out_frames, gainL, gainR, 0, output.format);
 	}
 
 	if (alsa.mmap) {
@@ -639,20 +1213,202 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 		}
 	}
 
+	if (slave_count) {
+		_slaves_write(out_frames, silence, inputptr, gainL, gainR, flags, cross ? &slave_cross : NULL, ramp);
+	}
+
 	return (int)out_frames;
 }
 
+// replace the delay with the one the device status reports alongside its timestamp, returning the gettime_us time
+// both were taken, or the current time if the device is not running or timestamped
+static u64_t alsa_delay_time(unsigned *frames) {
+	snd_pcm_status_t *status;
+	snd_htimestamp_t ts;
+	snd_pcm_status_alloca(&status);
+	if (alsa.tstamp && snd_pcm_status(pcmp, status) == 0 && snd_pcm_status_get_state(status) == SND_PCM_STATE_RUNNING) {
+		snd_pcm_status_get_htstamp(status, &ts);
+		if ((ts.tv_sec || ts.tv_nsec) && snd_pcm_status_get_delay(status) >= 0) {
+			*frames = snd_pcm_status_get_delay(status);
+			return (u64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		}
+	}
+	return gettime_us();
+}
+
+static void alsa_wake(void) {
+	wake_signal(wake_e);
+}
+
+// sleep until the device can take avail_min frames or the thread is woken, or timeout ms (-1 for none) have passed
+// returns as snd_pcm_wait, 1 if ready or woken, 0 on timeout or a negative error, only waiting to be woken if closed
+static int alsa_wait(int timeout) {
+	struct pollfd pfds[MAX_POLL_FDS + 1];
+	unsigned short revents = 0;
+	int n = 0, err;
+
+	if (pcmp && (n = snd_pcm_poll_descriptors(pcmp, pfds, MAX_POLL_FDS)) < 0) {
+		return n;
+	}
+	pfds[n].fd = WAKE_FD(wake_e);
+	pfds[n].events = POLLIN;
+
+	// descriptors may become ready without the device being able to take a period, so poll again until it can
+	do {
+		if ((err = poll(pfds, n + 1, timeout)) <= 0) {
+			return err < 0 && errno != EINTR ? -errno : (err < 0);
+		}
+		if (pfds[n].revents) {
+			wake_clear(pfds[n].fd);
+			return 1;
+		}
+		if ((err = snd_pcm_poll_descriptors_revents(pcmp, pfds, n, &revents)) < 0) {
+			return err;
+		}
+		if (revents & (POLLERR | POLLNVAL)) {
+			switch (snd_pcm_state(pcmp)) {
+			case SND_PCM_STATE_XRUN:         return -EPIPE;
+			case SND_PCM_STATE_SUSPENDED:    return -ESTRPIPE;
+			case SND_PCM_STATE_DISCONNECTED: return -ENODEV;
+			default:                         return -EIO;
+			}
+		}
+	} while (!(revents & POLLOUT));
+
+	return 1;
+}
+
+#if TSCHED
+// frames kept queued in the device when refilling on a timer, at most half the buffer
+static snd_pcm_sframes_t tsched_margin(void) {
+	return min((snd_pcm_sframes_t)(alsa.tsched * alsa.rate / 1000), (snd_pcm_sframes_t)alsa.buffer_size / 2);
+}
+
+// timer scheduling: sleep until the device delay falls to the margin, or the thread is woken or min_ms have passed
+// returns 1 when woken, else 0
+static int alsa_timer_wait(int min_ms) {
+	struct itimerspec its;
+	struct pollfd pfds[2];
+	snd_pcm_sframes_t delay = 0, margin = tsched_margin();
+	u64_t ns;
+
+	// delay errors are seen and recovered by the next avail_update, at least 1ms so a stalled device can't spin
+	if (snd_pcm_delay(pcmp, &delay) < 0 || delay < margin) {
+		delay = margin;
+	}
+	ns = max((u64_t)(delay - margin) * 1000000000 / alsa.rate, (u64_t)1000000);
+	if (min_ms >= 0) {
+		ns = min(ns, (u64_t)min_ms * 1000000);
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ns / 1000000000;
+	its.it_value.tv_nsec = ns % 1000000000;
+	timerfd_settime(alsa.timer_fd, 0, &its, NULL);
+
+	pfds[0].fd = alsa.timer_fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = WAKE_FD(wake_e);
+	pfds[1].events = POLLIN;
+
+	if (poll(pfds, 2, -1) > 0) {
+		if (pfds[0].revents) {
+			u64_t expired;
+			if (read(alsa.timer_fd, &expired, sizeof(expired)) < 0) {
+				LOG_SDEBUG("timer read: %s", strerror(errno));
+			}
+		}
+		if (pfds[1].revents) {
+			wake_clear(pfds[1].fd);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// called with mutex locked once woken when refilling on a timer, so changes of state, volume or position are heard
+// promptly rather than after seconds of queued audio: frames beyond the margin are rewound from the device, silence or
+// flushed audio dropped and audio replayed from the outputbuf history, not while fading as history is not rewound
+// history is only replayed when the caller also holds the decode mutex, so no decode call is writing over it
+static void _alsa_rewind(bool replay) {
+	snd_pcm_sframes_t frames = snd_pcm_rewindable(pcmp) - tsched_margin();
+	unsigned i;
+
+	frames = min(frames, (snd_pcm_sframes_t)output.tail_frames);
+	if (!output.tail_drop) {
+		frames = replay && output.fade == FADE_INACTIVE ? min(frames, (snd_pcm_sframes_t)_output_history()) : 0;
+	}
+	if (frames <= 0 || (frames = snd_pcm_rewind(pcmp, frames)) <= 0) {
+		return;
+	}
+	if (!output.tail_drop) {
+		_output_rewind(frames);
+	}
+	for (i = 0; i < slave_count; ++i) {
+		struct alsa_slave *sl = &slaves[i];
+		snd_pcm_sframes_t r;
+		if (!sl->pcm) {
+			continue;
+		}
+		// frames a slave could not rewind are dropped from its next write
+		if ((r = snd_pcm_rewind(sl->pcm, frames)) < 0) {
+			r = 0;
+		}
+		sl->slip += frames - r;
+		sl->written -= min((u64_t)r, sl->written);
+	}
+	output.tail_frames -= frames;
+	LOG_DEBUG("rewound %ld frames of %s", (long)frames, output.tail_drop ? "silence" : "audio");
+}
+
+// decode mutex is taken ahead of the output mutex as in the decode thread, but without waiting on a decode call in
+// progress, in which case only silence or flushed audio is rewound until the next wake
+static void alsa_rewind(void) {
+	bool replay = mutex_trylock(decode.mutex);
+	LOCK;
+	_alsa_rewind(replay);
+	UNLOCK;
+	if (replay) {
+		mutex_unlock(decode.mutex);
+	}
+}
+#endif
+
+// back off for a period, or until woken, where the device reports it is ready but takes no frames
+static void alsa_sleep(void) {
+	struct pollfd pfd;
+	int timeout = alsa.rate ? (int)max(alsa.period_size * 1000 / alsa.rate, 1) : 10;
+#if TSCHED
+	if (alsa.tsched && pcmp) {
+		// periods are long when refilling on a timer, so wake by the margin at the latest
+		if (alsa_timer_wait(timeout)) {
+			alsa_rewind();
+		}
+		return;
+	}
+#endif
+	pfd.fd = WAKE_FD(wake_e);
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout) > 0) {
+		wake_clear(pfd.fd);
+	}
+}
+
 static void *output_thread(void *arg) {
 	bool start = true;
 	bool output_off = (output.state == OUTPUT_OFF);
 	bool probe_device = (arg != NULL);
 	int err;
 
+	void *stack;
+	size_t stack_size;
+	bool stack_locked = lock_thread_stack(&stack, &stack_size);
+	LOG_INFO("output thread stack: %u bytes at %p%s", stack_size, stack, stack_locked ? " locked" : " not locked");
+
 	while (running) {
 
-		// disabled output - player is off
+		// disabled output - player is off, sleep until woken by a change of state, checking each second as a backstop
 		while (output_off) {
-			usleep(100000);
+			alsa_wait(1000);
 			LOCK;
 			output_off = (output.state == OUTPUT_OFF);
 			UNLOCK;
@@ -701,11 +1457,15 @@ static void *output_thread(void *arg) {
 #endif
 				output.error_opening = true;
 				UNLOCK;
+				if (rates_cached) {
+					rates_revalidate();
+				}
 				sleep(5);
 				continue;
 			}
 			output.error_opening = false;
 			start = true;
+			slaves_open();
 			UNLOCK;
 		}
 
@@ -764,34 +1524,41 @@ static void *output_thread(void *arg) {
 					}
 				} else {
 					start = false;
+					slaves_start();
 				}
-			} else {
-				usleep(10000);
-				if ((err = snd_pcm_wait(pcmp, 1000)) <= 0) {
-					if ( err == 0 ) {
-						LOG_INFO("pcm wait timeout");
-					}
-					if ((err = snd_pcm_recover(pcmp, err, 1)) < 0) {
-						LOG_INFO("pcm wait error: %s", snd_strerror(err));
-					}
-					start = true;
+			}
+#if TSCHED
+			else if (alsa.tsched) {
+				if (alsa_timer_wait(-1)) {
+					alsa_rewind();
 				}
 			}
+#endif
+			else if ((err = alsa_wait(1000)) <= 0) {
+				if ( err == 0 ) {
+					LOG_INFO("pcm wait timeout");
+				}
+				if ((err = snd_pcm_recover(pcmp, err, 1)) < 0) {
+					LOG_INFO("pcm wait error: %s", snd_strerror(err));
+				}
+				start = true;
+			}
 			continue;
 		}
 
 		// restrict avail to within sensible limits as alsa drivers can return erroneous large values
-		// in writei mode restrict to period_size due to size of write_buf
-		if (alsa.mmap) {
+		// in writei mode restrict to period_size, or when refilling on a timer the buffer_size write_buf is sized for
+		if (alsa.mmap || alsa.tsched) {
 			avail = min(avail, alsa.buffer_size);
 		} else {
 			avail = min(avail, alsa.period_size);
 		}
 
-		// avoid spinning in cases where wait returns but no bytes available (seen with pulse audio)
+		// avoid spinning in cases where wait returns but no bytes available (seen with pulse audio), backing off for a
+		// period unless woken
 		if (avail == 0) {
 			LOG_SDEBUG("avail 0 - sleeping");
-			usleep(10000);
+			alsa_sleep();
 			continue;
 		}
 
@@ -803,6 +1570,7 @@ static void *output_thread(void *arg) {
 			LOG_INFO("disabling output");
 			alsa_close();
 			pcmp = NULL;
+			slaves_close();
 			output_off = true;
 			vis_stop();
 #if GPIO
@@ -836,6 +1604,7 @@ static void *output_thread(void *arg) {
 		} else {
 			output.device_frames = delay;
 			output.updated = gettime_ms();
+			output.updated_us = output.state == OUTPUT_START_AT ? alsa_delay_time(&output.device_frames) : 0;
 			output.frames_played_dmp = output.frames_played;
 		}
 
@@ -847,7 +1616,7 @@ static void *output_thread(void *arg) {
 		// some output devices such as alsa null refuse any data, avoid spinning
 		if (!wrote) {
 			LOG_SDEBUG("wrote 0 - sleeping");
-			usleep(10000);
+			alsa_sleep();
 		}
 	}
 
@@ -915,6 +1684,7 @@ void output_init_alsa(log_level level, const char *device, unsigned output_buf_s
 	char *alsa_sample_fmt = NULL;
 	bool alsa_mmap = true;
 	bool alsa_reopen = false;
+	unsigned alsa_tsched = 0;
 
 	char *volume_mixer_name = next_param(volume_mixer, ',');
 	char *volume_mixer_index = next_param(NULL, ',');
@@ -924,12 +1694,14 @@ void output_init_alsa(log_level level, const char *device, unsigned output_buf_s
 	char *s = next_param(NULL, ':');
 	char *m = next_param(NULL, ':');
 	char *r = next_param(NULL, ':');
+	char *ts = next_param(NULL, ':');
 
 	if (t) alsa_buffer = atoi(t);
 	if (c) alsa_period = atoi(c);
 	if (s) alsa_sample_fmt = s;
 	if (m) alsa_mmap = atoi(m);
 	if (r) alsa_reopen = atoi(r);
+	if (ts) alsa_tsched = atoi(ts);
 
 	loglevel = level;
 
@@ -937,6 +1709,9 @@ void output_init_alsa(log_level level, const char *device, unsigned output_buf_s
 
 	memset(&output, 0, sizeof(output));
 
+	wake_create(wake_e);
+	output.wake_cb = alsa_wake;
+
 	alsa.mmap = alsa_mmap;
 	alsa.write_buf = NULL;
 #if DSD
@@ -945,9 +1720,27 @@ void output_init_alsa(log_level level, const char *device, unsigned output_buf_s
 	alsa.format = 0;
 #endif
 	alsa.reopen = alsa_reopen;
+	alsa.tsched = 0;
+	alsa.timer_fd = -1;
+	if (alsa_tsched) {
+#if TSCHED
+		if ((alsa.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) >= 0) {
+			alsa.tsched = alsa_tsched;
+		} else {
+			LOG_WARN("unable to create timer, using period wakeups: %s", strerror(errno));
+		}
+#else
+		LOG_WARN("timer scheduling not supported, using period wakeups");
+#endif
+	}
 	alsa.mixer_handle = NULL;
 	alsa.ctl = ctl4device(device);
 	alsa.mixer_ctl = mixer_device ? ctl4device(mixer_device) : alsa.ctl;
+	// hardware volume would only reach the output device, so further devices are fed with software volume applied
+	if (slave_count && volume_mixer_name && !mixer_unmute) {
+		LOG_WARN("volume control %s ignored with further devices, using software volume", volume_mixer_name);
+		volume_mixer_name = NULL;
+	}
 	alsa.volume_mixer_name = volume_mixer_name;
 	alsa.mixer_linear = mixer_linear;
 
@@ -956,28 +1749,28 @@ void output_init_alsa(log_level level, const char *device, unsigned output_buf_s
 	output.period = alsa_period;
 	output.start_frames = 0;
 	output.write_cb = &_write_frames;
+	output.narrow = true;
 	output.rate_delay = rate_delay;
+	alsa.open_us = 0;
 
 	if (alsa_sample_fmt) {
 #if DSD
-		if (!strcmp(alsa_sample_fmt, "32"))	alsa.pcmfmt = SND_PCM_FORMAT_S32_LE;
-		if (!strcmp(alsa_sample_fmt, "24")) alsa.pcmfmt = SND_PCM_FORMAT_S24_LE;
-		if (!strcmp(alsa_sample_fmt, "24_3")) alsa.pcmfmt = SND_PCM_FORMAT_S24_3LE;
-		if (!strcmp(alsa_sample_fmt, "16")) alsa.pcmfmt = SND_PCM_FORMAT_S16_LE;
+		alsa.pcmfmt = pcm_format_param(alsa_sample_fmt);
 #else
-		if (!strcmp(alsa_sample_fmt, "32"))	alsa.format = SND_PCM_FORMAT_S32_LE;
-		if (!strcmp(alsa_sample_fmt, "24")) alsa.format = SND_PCM_FORMAT_S24_LE;
-		if (!strcmp(alsa_sample_fmt, "24_3")) alsa.format = SND_PCM_FORMAT_S24_3LE;
-		if (!strcmp(alsa_sample_fmt, "16")) alsa.format = SND_PCM_FORMAT_S16_LE;
+		alsa.format = pcm_format_param(alsa_sample_fmt);
 #endif
 	}
 
-	LOG_INFO("requested alsa_buffer: %u alsa_period: %u format: %s mmap: %u", output.buffer, output.period, 
-			 alsa_sample_fmt ? alsa_sample_fmt : "any", alsa.mmap);
+	LOG_INFO("requested alsa_buffer: %u alsa_period: %u format: %s mmap: %u tsched: %u", output.buffer, output.period, 
+			 alsa_sample_fmt ? alsa_sample_fmt : "any", alsa.mmap, alsa.tsched);
 
 	snd_lib_error_set_handler((snd_lib_error_handler_t)alsa_error_handler);
 
 	output_init_common(level, device, output_buf_size, rates, idle);
+
+	if (alsa.tsched && !output.history_size) {
+		LOG_WARN("without playback history (-H) queued audio is not rewound, software volume changes are delayed by the buffer");
+	}
 	
 	if (volume_mixer_name) {
 	        if (mixer_init_alsa(alsa.mixer_ctl, alsa.volume_mixer_name, volume_mixer_index ?
@@ -993,24 +1786,9 @@ void output_init_alsa(log_level level, const char *device, unsigned output_buf_s
 		alsa.volume_mixer_name = NULL;
 	}
 
-#if LINUX
-	// RT linux - aim to avoid pagefaults by locking memory: 
+	// RT linux - aim to avoid pagefaults: buffers are prefaulted and locked when allocated and the output thread
+	// locks its own stack, rather than using mlockall which would also pin all codec libraries and heap
 	// https://rt.wiki.kernel.org/index.php/Threaded_RT-application_with_memory_locking_and_stack_handling_example
-	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
-		LOG_INFO("unable to lock memory: %s", strerror(errno));
-	} else {
-		LOG_INFO("memory locked");
-	}
-
-#ifdef __GLIBC__
-	mallopt(M_TRIM_THRESHOLD, -1);
-	mallopt(M_MMAP_MAX, 0);
-	LOG_INFO("glibc detected using mallopt");
-#endif
-
-	touch_memory(silencebuf, MAX_SILENCE_FRAMES * BYTES_PER_FRAME);
-	touch_memory(outputbuf->buf, outputbuf->size);
-#endif
 
 	// start output thread
 	pthread_attr_t attr;
@@ -1030,13 +1808,25 @@ void output_init_alsa(log_level level, const char *device, unsigned output_buf_s
 }
 
 void output_close_alsa(void) {
+	unsigned i;
+
 	LOG_INFO("close output");
 
 	LOCK;
 	running = false;
 	UNLOCK;
+	alsa_wake();
 
 	pthread_join(thread, NULL);
+	wake_close(wake_e);
+#if TSCHED
+	if (alsa.timer_fd >= 0) close(alsa.timer_fd);
+#endif
+
+	slaves_close();
+	for (i = 0; i < slave_count; ++i) {
+		free(slaves[i].buf);
+	}
 
 	if (alsa.write_buf) free(alsa.write_buf);
 	if (alsa.ctl) free(alsa.ctl);
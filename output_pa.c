@@ -453,26 +453,26 @@ void _pa_open(void) {
 static u8_t *optr;
 
 static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
-						 s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr) {
+						 struct cross_mix *cross, const struct gain_ramp *ramp) {
 	
 	if (!silence) {
-		
-		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
-			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
-		}
-		
-		if (gainL != FIXED_ONE || gainR!= FIXED_ONE) {
-			_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
-		}
 
-		IF_DSD(
-			if (output.outfmt == DOP) {
-				update_dop((u32_t *) outputbuf->readp, out_frames, output.invert);
-			} else if (output.outfmt != PCM && output.invert)
-				dsd_invert((u32_t *) outputbuf->readp, out_frames);
-		)
-
-		memcpy(optr, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		// cross fade, dop markers / dsd invert, mono flags and gain applied in one pass copying to the native S32 buffer,
+		// leaving outputbuf unmodified, output.format is S32_LE for portaudio
+		_scale_and_pack_fused(&output.pack, optr, (s32_t *)(void *)outputbuf->readp, out_frames, gainL, gainR,
+							  outputbuf, cross, ramp);
+#if !SL_LITTLE_ENDIAN
+		// back to native order
+		{
+			u32_t *ptr = (u32_t *)(void *)optr;
+			frames_t count = out_frames * 2;
+			while (count--) {
+				u32_t sample = *ptr;
+				*(ptr++) = (sample & 0xff000000) >> 24 | (sample & 0x00ff0000) >> 8 |
+					(sample & 0x0000ff00) << 8 | (sample & 0x000000ff) << 24;
+			}
+		}
+#endif
 
 	} else {
 
@@ -26,6 +26,12 @@
 #define MAX_SCALESAMPLE 0x7fffffffffffLL
 #define MIN_SCALESAMPLE -MAX_SCALESAMPLE
 
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
 // inlining these on windows prevents them being linkable...
 #if !WIN
 inline 
@@ -43,7 +49,20 @@ s32_t to_gain(float f) {
 	return (s32_t)(f * 65536.0F);
 }
 
-void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format) {
+static unsigned packed_frame_bytes(output_format format) {
+	switch (format) {
+	case S24_3LE: return 6;
+	case S16_LE:  return 4;
+#if DSD
+	case U16_LE:
+	case U16_BE:  return 4;
+	case U8:      return 2;
+#endif
+	default:      return 8;
+	}
+}
+
+static ALWAYS_INLINE void mono_frames(s32_t *inputptr, frames_t cnt, u8_t flags) {
 	// in-place copy input samples if mono/combined is used (never happens with DSD active)
 	if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
 		s32_t *ptr = inputptr;
@@ -68,6 +87,22 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 			ptr += 2;
 		}
 	}
+}
+
+// pack body, inlined with constant flags, format and unity by the specialised functions below
+static ALWAYS_INLINE void scale_and_pack(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR,
+										 u8_t flags, output_format format, bool unity) {
+	mono_frames(inputptr, cnt, flags);
+
+#if PACK_SIMD
+	// vector kernel packs whole blocks, remaining frames are packed below
+	{
+		frames_t done = _scale_and_pack_simd(outputptr, inputptr, cnt, gainL, gainR, format, unity);
+		outputptr = (u8_t *)outputptr + done * packed_frame_bytes(format);
+		inputptr += done * 2;
+		cnt -= done;
+	}
+#endif
 
 	switch(format) {
 #if DSD
@@ -168,7 +203,7 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		{
 			u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			if (unity) {
 				while (cnt--) {
 					*(optr++) = (*(inputptr) >> 16 & 0x0000ffff) | (*(inputptr + 1) & 0xffff0000);
 					inputptr += 2;
@@ -180,7 +215,7 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 				}
 			}
 #else
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			if (unity) {
 				while (cnt--) {
 					s32_t lsample = *(inputptr++);
 					s32_t rsample = *(inputptr++);
@@ -197,6 +232,33 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 						(rsample & 0x00ff0000) >> 8 | (rsample & 0xff000000) >> 24;
 				}
 			}
+#endif
+		}
+		break;
+	case FLOAT_LE:
+		{
+			// gain is applied in float so boosts above unity are not clipped here
+			float scaleL = (float)(unity ? FIXED_ONE : gainL) * FLOAT_GAIN_SCALE;
+			float scaleR = (float)(unity ? FIXED_ONE : gainR) * FLOAT_GAIN_SCALE;
+#if SL_LITTLE_ENDIAN
+			float *optr = (float *)(void *)outputptr;
+			while (cnt--) {
+				*(optr++) = (float)*(inputptr++) * scaleL;
+				*(optr++) = (float)*(inputptr++) * scaleR;
+			}
+#else
+			u32_t *optr = (u32_t *)(void *)outputptr;
+			while (cnt--) {
+				union { float f; u32_t u; } l, r;
+				l.f = (float)*(inputptr++) * scaleL;
+				r.f = (float)*(inputptr++) * scaleR;
+				*(optr++) = 
+					(l.u & 0xff000000) >> 24 | (l.u & 0x00ff0000) >> 8 |
+					(l.u & 0x0000ff00) << 8  | (l.u & 0x000000ff) << 24;
+				*(optr++) = 
+					(r.u & 0xff000000) >> 24 | (r.u & 0x00ff0000) >> 8 |
+					(r.u & 0x0000ff00) << 8  | (r.u & 0x000000ff) << 24;
+			}
 #endif
 		}
 		break;
@@ -204,7 +266,7 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		{
 			u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			if (unity) {
 				while (cnt--) {
 					*(optr++) = *(inputptr++) >> 8;
 					*(optr++) = *(inputptr++) >> 8;
@@ -216,7 +278,7 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 				}
 			}
 #else
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			if (unity) {
 				while (cnt--) {
 					s32_t lsample = *(inputptr++);
 					s32_t rsample = *(inputptr++);
@@ -241,7 +303,7 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 	case S24_3LE:
 		{
 			u8_t *optr = (u8_t *)(void *)outputptr;
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			if (unity) {
 				while (cnt) {
 					// attempt to do 32 bit memory accesses - move 2 frames at once: 16 bytes -> 12 bytes
 					// falls through to exception case when not aligned or if less than 2 frames to move
@@ -320,7 +382,7 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		{
 			u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			if (unity) {
 				memcpy(outputptr, inputptr, cnt * BYTES_PER_FRAME);
 			} else {
 				while (cnt--) {
@@ -329,7 +391,7 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 				}
 			}
 #else
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			if (unity) {
 				while (cnt--) {
 					s32_t lsample = *(inputptr++);
 					s32_t rsample = *(inputptr++);
@@ -360,50 +422,466 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 	}
 }
 
+// specialised pack functions for each format, mono flags and gain class, selected by _pack_select when these change
+#define PACK_SPEC(fmt, mono, unity) \
+static void pack_##fmt##_##mono##_##unity(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR) { \
+	scale_and_pack(outputptr, inputptr, cnt, gainL, gainR, mono, fmt, unity); \
+}
+#define PACK_SPECS(fmt) \
+	PACK_SPEC(fmt, 0, 0) PACK_SPEC(fmt, 0, 1) PACK_SPEC(fmt, 1, 0) PACK_SPEC(fmt, 1, 1) \
+	PACK_SPEC(fmt, 2, 0) PACK_SPEC(fmt, 2, 1) PACK_SPEC(fmt, 3, 0) PACK_SPEC(fmt, 3, 1)
+#define PACK_ROW(fmt) { \
+	{ pack_##fmt##_0_0, pack_##fmt##_0_1 }, { pack_##fmt##_1_0, pack_##fmt##_1_1 }, \
+	{ pack_##fmt##_2_0, pack_##fmt##_2_1 }, { pack_##fmt##_3_0, pack_##fmt##_3_1 } }
+
+PACK_SPECS(S32_LE)
+PACK_SPECS(S24_LE)
+PACK_SPECS(S24_3LE)
+PACK_SPECS(S16_LE)
+PACK_SPECS(FLOAT_LE)
+
+static void (* const pack_pcm[][4][2])(void *, s32_t *, frames_t, s32_t, s32_t) = {
+	PACK_ROW(S32_LE), PACK_ROW(S24_LE), PACK_ROW(S24_3LE), PACK_ROW(S16_LE), PACK_ROW(FLOAT_LE),
+};
+
+#if DSD
+// dsd formats are packed without gain or mono flags
+PACK_SPEC(U8, 0, 1)
+PACK_SPEC(U16_LE, 0, 1)
+PACK_SPEC(U16_BE, 0, 1)
+PACK_SPEC(U32_LE, 0, 1)
+PACK_SPEC(U32_BE, 0, 1)
+
+static void (* const pack_dsd[])(void *, s32_t *, frames_t, s32_t, s32_t) = {
+	pack_U8_0_1, pack_U16_LE_0_1, pack_U16_BE_0_1, pack_U32_LE_0_1, pack_U32_BE_0_1,
+};
+#endif
+
+// frames processed at a time through a block on the stack when widening narrow frames or fusing passes over
+// outputbuf, small enough to stay in cache
+#define BLOCK_FRAMES 256
+
+// dither: gained samples are requantised to the output word length with tpdf dither of +-1 lsb rather than truncated,
+// the requantisation error optionally shaped by feeding it back through one of the filters below (noise transfer
+// function 1 - sum(coef[k] z^-(k+1)), coef in Q12). Samples are halved while dithered so the dither and rounding can't
+// overflow 32 bits, the bit lost being far below the output lsb.
+dither_type pack_dither = DITHER_NONE;
+
+static const struct {
+	const char *name;
+	unsigned taps;
+	s32_t coef[5];
+} dithers[] = {
+	{ "none",     0, { 0 } },
+	{ "tpdf",     0, { 0 } },                                 // flat
+	{ "shaped1",  1, { 4096 } },                              // first order highpass
+	{ "shaped2",  2, { 8192, -4096 } },                       // second order highpass
+	{ "lipshitz", 5, { 8327, -8868, 8024, -6513, 2519 } },    // Lipshitz psychoacoustic weighting, for 44.1/48kHz
+};
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// xorshift prng lanes and error history, per thread so packing from more than one thread needs no locking
+static THREAD_LOCAL struct {
+	u32_t seed[8];
+	s32_t err[2][5];
+} dither_state;
+
+static inline u32_t xorshift32(u32_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+// gain and requantise cnt frames of iptr to optr with the bits below the output lsb clear, mask being the bits below
+// the lsb of the halved sample
+static void dither_frames(s32_t *optr, s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, dither_type type, s32_t mask) {
+	u32_t *seed = dither_state.seed;
+	s32_t half = (mask + 1) / 2, top = 0x3fffffff & ~mask, bot = -0x40000000;
+	unsigned taps = dithers[type].taps;
+	unsigned i;
+
+	if (!seed[0]) {
+		for (i = 0; i < 8; ++i) {
+			seed[i] = ((u32_t)(uintptr_t)&dither_state + i) * 2654435761u | 1;
+		}
+	}
+
+	if (!taps) {
+		// flat tpdf, samples taking prng lanes in turn as the vector kernel does
+#if PACK_SIMD
+		frames_t done = _dither_simd(optr, iptr, cnt, gainL, gainR, mask, seed);
+		optr += done * 2;
+		iptr += done * 2;
+		cnt -= done;
+#endif
+		for (i = 0; i < cnt * 2; ++i) {
+			u32_t r = xorshift32(&seed[i & 3]);
+			s32_t v = (gain(i & 1 ? gainR : gainL, iptr[i]) >> 1) + (s32_t)(r & mask) - (s32_t)(r >> 16 & mask) + half;
+			v &= ~mask;
+			v = v > top ? top : v < bot ? bot : v;
+			optr[i] = (s32_t)((u32_t)v << 1);
+		}
+		return;
+	}
+
+	// noise shaped, the error feedback is serial in each channel
+	for (i = 0; i < cnt * 2; ++i) {
+		unsigned c = i & 1, k;
+		s32_t *err = dither_state.err[c];
+		u32_t r = xorshift32(&seed[c]);
+		s64_t fb = 0;
+		s32_t u, v, e;
+		for (k = 0; k < taps; ++k) {
+			fb += (s64_t)dithers[type].coef[k] * err[k];
+		}
+		u = (gain(c ? gainR : gainL, iptr[i]) >> 1) - (s32_t)(fb >> 12);
+		v = (u + (s32_t)(r & mask) - (s32_t)(r >> 16 & mask) + half) & ~mask;
+		v = v > top ? top : v < bot ? bot : v;
+		// bound the error fed back so clipping can't make the filter unstable
+		e = v - u;
+		e = e > 2 * (mask + 1) ? 2 * (mask + 1) : e < -2 * (mask + 1) ? -2 * (mask + 1) : e;
+		for (k = taps - 1; k > 0; --k) {
+			err[k] = err[k - 1];
+		}
+		err[0] = e;
+		optr[i] = (s32_t)((u32_t)v << 1);
+	}
+}
+
+// mono flags, then gain and dither a block at a time, then the unity pack of format
+static void pack_dithered(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format) {
+	s32_t block[BLOCK_FRAMES * 2];
+	s32_t mask = format == S16_LE ? 0x7fff : 0x7f;
+	unsigned bytes = packed_frame_bytes(format);
+
+	mono_frames(inputptr, cnt, flags);
+
+	while (cnt) {
+		frames_t count = min(cnt, BLOCK_FRAMES);
+		dither_frames(block, inputptr, count, gainL, gainR, pack_dither, mask);
+		pack_pcm[format][0][1](outputptr, block, count, FIXED_ONE, FIXED_ONE);
+		outputptr = (u8_t *)outputptr + count * bytes;
+		inputptr += count * 2;
+		cnt -= count;
+	}
+}
+
+#define PACK_DITHER(fmt, mono) \
+static void pack_##fmt##_##mono##_dither(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR) { \
+	pack_dithered(outputptr, inputptr, cnt, gainL, gainR, mono, fmt); \
+}
+#define PACK_DITHERS(fmt) PACK_DITHER(fmt, 0) PACK_DITHER(fmt, 1) PACK_DITHER(fmt, 2) PACK_DITHER(fmt, 3)
+#define DITHER_ROW(fmt) { pack_##fmt##_0_dither, pack_##fmt##_1_dither, pack_##fmt##_2_dither, pack_##fmt##_3_dither }
+#define DITHER_NAMES(fmt) { #fmt, #fmt " tpdf", #fmt " shaped1", #fmt " shaped2", #fmt " lipshitz" }
+
+PACK_DITHERS(S24_LE)
+PACK_DITHERS(S24_3LE)
+PACK_DITHERS(S16_LE)
+
+static void (* const pack_dither_pcm[][4])(void *, s32_t *, frames_t, s32_t, s32_t) = {
+	{ NULL }, DITHER_ROW(S24_LE), DITHER_ROW(S24_3LE), DITHER_ROW(S16_LE),
+};
+
+static const char *dither_names[][5] = {
+	{ NULL }, DITHER_NAMES(S24_LE), DITHER_NAMES(S24_3LE), DITHER_NAMES(S16_LE),
+};
+
+// dither applies when gain is scaled and the output is narrower than the samples
+static inline dither_type dither_for(output_format format, bool unity) {
+	return !unity && (format == S24_LE || format == S24_3LE || format == S16_LE) ? pack_dither : DITHER_NONE;
+}
+
+// set the dither type by name, returning false if unknown
+bool pack_dither_set(const char *type) {
+	unsigned i;
+	for (i = 0; i < sizeof(dithers) / sizeof(dithers[0]); ++i) {
+		if (!strcmp(type, dithers[i].name)) {
+			pack_dither = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format) {
+	bool unity = gainL == FIXED_ONE && gainR == FIXED_ONE;
+	if (dither_for(format, unity)) {
+		pack_dithered(outputptr, inputptr, cnt, gainL, gainR, flags, format);
+		return;
+	}
+	scale_and_pack(outputptr, inputptr, cnt, gainL, gainR, flags, format, unity);
+}
+
+static const char *format_names[] = {
+	"S32_LE", "S24_LE", "S24_3LE", "S16_LE", "FLOAT_LE",
+#if DSD
+	"U8", "U16_LE", "U16_BE", "U32_LE", "U32_BE",
+#endif
+};
+
+// select the specialised pack for format, flags, gain class and dither, returning true if the selection changed
+bool _pack_select(struct pack_spec *spec, output_format format, u8_t flags, bool unity) {
+	dither_type dither = dither_for(format, unity);
+	if (spec->pack && spec->format == format && spec->flags == flags && spec->unity == unity && spec->dither == dither) {
+		return false;
+	}
+	spec->format = format;
+	spec->flags = flags;
+	spec->unity = unity;
+	spec->dither = dither;
+	spec->bytes = packed_frame_bytes(format);
+	spec->name = format_names[format];
+#if DSD
+	if (format >= U8) {
+		spec->pack = pack_dsd[format - U8];
+		return true;
+	}
+#endif
+	if (dither) {
+		spec->pack = pack_dither_pcm[format][flags & (MONO_LEFT | MONO_RIGHT)];
+		spec->name = dither_names[format][dither];
+		return true;
+	}
+	spec->pack = pack_pcm[format][flags & (MONO_LEFT | MONO_RIGHT)][unity];
+	return true;
+}
+
+
+// gain << RAMP_SHIFT at frame pos of a ramp
+static inline s32_t ramp_acc(s32_t gain, s32_t step, frames_t pos) {
+	return gain * (1 << RAMP_SHIFT) + step * (s32_t)pos;
+}
+
+// gains of ramp applied to cnt frames from frame pos of the chunk
+static void ramp_frames(s32_t *optr, s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, const struct gain_ramp *ramp, frames_t pos) {
+	s32_t accL = ramp_acc(gainL, ramp->stepL, pos), accR = ramp_acc(gainR, ramp->stepR, pos);
+#if PACK_SIMD
+	frames_t done = _gain_ramp_simd(optr, iptr, cnt, accL, accR, ramp->stepL, ramp->stepR);
+	optr += done * 2;
+	iptr += done * 2;
+	cnt -= done;
+	accL += ramp->stepL * (s32_t)done;
+	accR += ramp->stepR * (s32_t)done;
+#endif
+	while (cnt--) {
+		*(optr++) = gain(accL >> RAMP_SHIFT, *(iptr++));
+		*(optr++) = gain(accR >> RAMP_SHIFT, *(iptr++));
+		accL += ramp->stepL;
+		accR += ramp->stepR;
+	}
+}
+
+static inline bool ramped(const struct gain_ramp *ramp) {
+	return ramp && (ramp->stepL || ramp->stepR);
+}
+
+// pack samples which already have gain applied, as for scaled gain so dithered if set
+static void pack_scaled(void *outputptr, s32_t *inputptr, frames_t cnt, output_format format) {
+	if (dither_for(format, false)) {
+		pack_dithered(outputptr, inputptr, cnt, FIXED_ONE, FIXED_ONE, 0, format);
+	} else {
+		pack_pcm[format][0][1](outputptr, inputptr, cnt, FIXED_ONE, FIXED_ONE);
+	}
+}
+
+// narrow 16 bit frames to full width
+static inline void widen_frames(s32_t *optr, const s16_t *iptr, frames_t cnt) {
+	cnt *= 2;
+	while (cnt--) {
+		*(optr++) = *(iptr++) << 16;
+	}
+}
+
+void _scale_and_pack_frames16(void *outputptr, s16_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format,
+							  const struct gain_ramp *ramp) {
+	// pack narrow 16 bit frames from outputbuf, S16_LE is packed directly unless dithered or ramped, other formats
+	// are widened in blocks
+	if (format != S16_LE || dither_for(format, gainL == FIXED_ONE && gainR == FIXED_ONE) || ramped(ramp)) {
+		s32_t wide[BLOCK_FRAMES * 2];
+		frames_t pos = 0;
+		while (cnt) {
+			frames_t count = min(cnt, BLOCK_FRAMES);
+			widen_frames(wide, inputptr, count);
+			inputptr += count * 2;
+			if (ramped(ramp)) {
+				mono_frames(wide, count, flags);
+				ramp_frames(wide, wide, count, gainL, gainR, ramp, pos);
+				pack_scaled(outputptr, wide, count, format);
+			} else {
+				_scale_and_pack_frames(outputptr, wide, count, gainL, gainR, flags, format);
+			}
+			outputptr = (u8_t *)outputptr + count * packed_frame_bytes(format);
+			cnt -= count;
+			pos += count;
+		}
+		return;
+	}
+
+	{
+		u16_t *optr = (u16_t *)(void *)outputptr;
+#if SL_LITTLE_ENDIAN
+		if (gainL == FIXED_ONE && gainR == FIXED_ONE && !(flags & (MONO_LEFT | MONO_RIGHT))) {
+			memcpy(outputptr, inputptr, cnt * NARROW_BYTES_PER_FRAME);
+			return;
+		}
+#endif
+		while (cnt--) {
+			s32_t l = *(inputptr++);
+			s32_t r = *(inputptr++);
+			u16_t lsample, rsample;
+			// mono/combined is applied to the output so outputbuf is left unmodified for history and further devices
+			if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+				l = r = (l + r) / 2;
+			} else if (flags & MONO_RIGHT) {
+				l = r;
+			} else if (flags & MONO_LEFT) {
+				r = l;
+			}
+			lsample = gain(gainL, l << 16) >> 16;
+			rsample = gain(gainR, r << 16) >> 16;
+#if SL_LITTLE_ENDIAN
+			*(optr++) = lsample;
+			*(optr++) = rsample;
+#else
+			*(optr++) = lsample >> 8 | lsample << 8;
+			*(optr++) = rsample >> 8 | rsample << 8;
+#endif
+		}
+	}
+}
+
+// mix iptr, the track fading out, with the track fading in at cross->ptr into optr (which may be iptr). The track
+// fading in is read a contiguous segment of outputbuf at a time, widened through a block if stored as narrow frames.
+// Gains are ramped by ramp if set, from frame pos of the chunk.
+static void cross_frames(s32_t *optr, s32_t *iptr, frames_t frames, struct buffer *outputbuf, struct cross_mix *cross,
+						 const struct gain_ramp *ramp, frames_t pos) {
+	s32_t wide[BLOCK_FRAMES * 2];
+	bool narrow = cross->in_bytes != BYTES_PER_FRAME;
+	bool ramp_cross = ramp && (ramp->step_in || ramp->step_out);
+	s32_t acc_in = 0, acc_out = 0;
+	if (ramp_cross) {
+		acc_in = ramp_acc(cross->gain_in, ramp->step_in, pos);
+		acc_out = ramp_acc(cross->gain_out, ramp->step_out, pos);
+	}
+	while (frames) {
+		frames_t count;
+		s32_t *xptr;
+		if (cross->ptr >= outputbuf->wrap) {
+			cross->ptr -= outputbuf->size;
+		}
+		count = min(frames, (frames_t)(outputbuf->wrap - cross->ptr) / cross->in_bytes);
+		if (narrow) {
+			count = min(count, BLOCK_FRAMES);
+			widen_frames(wide, (s16_t *)(void *)cross->ptr, count);
+			xptr = wide;
+		} else {
+			xptr = (s32_t *)(void *)cross->ptr;
+		}
+		cross->ptr += count * cross->in_bytes;
+		frames -= count;
+		if (ramp_cross) {
+#if PACK_SIMD
+			frames_t done = _cross_ramp_simd(optr, iptr, xptr, count, acc_in, acc_out, ramp->step_in, ramp->step_out);
+			optr += done * 2; iptr += done * 2; xptr += done * 2;
+			acc_in += ramp->step_in * (s32_t)done;
+			acc_out += ramp->step_out * (s32_t)done;
+			count -= done;
+#endif
+			while (count--) {
+				*(optr++) = gain(acc_out >> RAMP_SHIFT, *(iptr++)) + gain(acc_in >> RAMP_SHIFT, *(xptr++));
+				*(optr++) = gain(acc_out >> RAMP_SHIFT, *(iptr++)) + gain(acc_in >> RAMP_SHIFT, *(xptr++));
+				acc_in += ramp->step_in;
+				acc_out += ramp->step_out;
+			}
+			continue;
+		}
+#if PACK_SIMD
+		{
+			frames_t done = _apply_cross_simd(optr, iptr, xptr, count, cross->gain_in, cross->gain_out);
+			optr += done * 2; iptr += done * 2; xptr += done * 2;
+			count -= done;
+		}
+#endif
+		count *= 2;
+		while (count--) {
+			*(optr++) = gain(cross->gain_out, *(iptr++)) + gain(cross->gain_in, *(xptr++));
+		}
+	}
+}
+
+// mix in place at readp, the track fading out being stored as full width frames
 #if !WIN
 inline 
 #endif
-void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr) {
+void _apply_cross(struct buffer *outputbuf, frames_t out_frames, struct cross_mix *cross, const struct gain_ramp *ramp) {
 	s32_t *ptr = (s32_t *)(void *)outputbuf->readp;
-	frames_t count = out_frames * 2;
-	while (count--) {
-		if (*cross_ptr > (s32_t *)outputbuf->wrap) {
-			*cross_ptr -= outputbuf->size / BYTES_PER_FRAME * 2;
-		}
-		*ptr = gain(cross_gain_out, *ptr) + gain(cross_gain_in, **cross_ptr);
-		ptr++; (*cross_ptr)++;
-	}
+	cross_frames(ptr, ptr, out_frames, outputbuf, cross, ramp, 0);
 }
 
 #if !WIN
 inline 
 #endif
-void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags) {
+void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags, const struct gain_ramp *ramp) {
+	ISAMPLE_T *base = (ISAMPLE_T *)(void *)outputbuf->readp;
+	if (ramped(ramp)) {
+		s32_t accL = ramp_acc(gainL, ramp->stepL, 0), accR = ramp_acc(gainR, ramp->stepR, 0);
+		if (!(flags & (MONO_LEFT | MONO_RIGHT))) {
+			ramp_frames(base, base, count, gainL, gainR, ramp, 0);
+			return;
+		}
+		// mono flags as below with each frame's gains
+		while (count--) {
+			ISAMPLE_T l = gain(accL >> RAMP_SHIFT, *base), r = gain(accR >> RAMP_SHIFT, *(base + 1));
+			if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+				*base = *(base + 1) = (l + r) / 2;
+			} else {
+				*base = *(base + 1) = flags & MONO_RIGHT ? r : l;
+			}
+			base += 2;
+			accL += ramp->stepL;
+			accR += ramp->stepR;
+		}
+		return;
+	}
 	if (gainL == FIXED_ONE && gainR == FIXED_ONE && !(flags & (MONO_LEFT | MONO_RIGHT))) {
 		return;
-	} else if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
-		ISAMPLE_T *ptrL = (ISAMPLE_T *)(void *)outputbuf->readp;
-		ISAMPLE_T *ptrR = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
+	}
+#if PACK_SIMD
+	{
+		frames_t done = _apply_gain_simd(base, count, gainL, gainR, flags);
+		base += done * 2;
+		count -= done;
+	}
+#endif
+	if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+		ISAMPLE_T *ptrL = base;
+		ISAMPLE_T *ptrR = base + 1;
 		while (count--) {
 			*ptrL = *ptrR = (gain(gainL, *ptrL) + gain(gainR, *ptrR)) / 2;
 			ptrL += 2; ptrR += 2;
 		}
 
 	} else if (flags & MONO_RIGHT) {
-		ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
+		ISAMPLE_T *ptr = base + 1;
 		while (count--) {
 			*(ptr - 1) = *ptr = gain(gainR, *ptr);
 			ptr += 2;
 		}
 	} else if (flags & MONO_LEFT) {
-		ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp;
+		ISAMPLE_T *ptr = base;
 		while (count--) {
 			*(ptr + 1) = *ptr = gain(gainL, *ptr);
 			ptr += 2;
 		}
 	} else {
-	   	ISAMPLE_T *ptrL = (ISAMPLE_T *)(void *)outputbuf->readp;
-		ISAMPLE_T *ptrR = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
+	   	ISAMPLE_T *ptrL = base;
+		ISAMPLE_T *ptrR = base + 1;
 		while (count--) {
 			*ptrL = gain(gainL, *ptrL);
 			*ptrR = gain(gainR, *ptrR);
@@ -411,3 +889,50 @@ void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t ga
 		}
 	}
 }
+
+// single pass from outputbuf to the device: crossfade mix (if cross set), then the dop markers or dsd invert, mono
+// flags, gain and pack of spec are applied a block at a time on the stack, so input is read once and left unmodified
+// and output written once. Gains are ramped per frame if ramp is set, the ramped gain being applied in the block before
+// packing as scaled. Input is full width frames unless crossfading, when it is at the width of the track fading out.
+void _scale_and_pack_fused(struct pack_spec *spec, void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR,
+						   struct buffer *outputbuf, struct cross_mix *cross, const struct gain_ramp *ramp) {
+	s32_t block[BLOCK_FRAMES * 2];
+	unsigned step = cross ? cross->out_bytes / sizeof(s32_t) : 2;
+	frames_t pos = 0;
+
+	if (!cross && !spec->flags && !ramped(ramp)) {
+		// input is not modified so packed directly
+		spec->pack(outputptr, inputptr, cnt, gainL, gainR);
+		return;
+	}
+
+	while (cnt) {
+		frames_t count = min(cnt, BLOCK_FRAMES);
+		if (cross && step != 2) {
+			widen_frames(block, (s16_t *)(void *)inputptr, count);
+			cross_frames(block, block, count, outputbuf, cross, ramp, pos);
+		} else if (cross) {
+			cross_frames(block, inputptr, count, outputbuf, cross, ramp, pos);
+		} else {
+			memcpy(block, inputptr, count * BYTES_PER_FRAME);
+		}
+#if DSD
+		if (spec->flags & DSD_DOP) {
+			update_dop((u32_t *)(void *)block, count, spec->flags & DSD_INVERT);
+		} else if (spec->flags & DSD_INVERT) {
+			dsd_invert((u32_t *)(void *)block, count);
+		}
+#endif
+		if (ramped(ramp)) {
+			mono_frames(block, count, spec->flags);
+			ramp_frames(block, block, count, gainL, gainR, ramp, pos);
+			spec->pack(outputptr, block, count, FIXED_ONE, FIXED_ONE);
+		} else {
+			spec->pack(outputptr, block, count, gainL, gainR);
+		}
+		outputptr = (u8_t *)outputptr + count * spec->bytes;
+		inputptr += count * step;
+		cnt -= count;
+		pos += count;
+	}
+}
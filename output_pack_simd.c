@@ -0,0 +1,805 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2015, triode1@btinternet.com
+ *      Ralph Irving 2015-2025, ralph_irving@hotmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// SIMD kernels for _scale_and_pack_frames, _apply_gain, _apply_cross, gain ramps and dither - sse2 / avx2 on x86, neon on arm
+// Each kernel processes the largest whole number of vector blocks of cnt and returns the frames it processed, leaving
+// the remainder to the scalar code in output_pack.c which remains the reference: results must be bit exact with it.
+// The scalar gain() is sat32((s64)gain * sample >> 16), its clamp of the 64 bit product being equivalent to
+// saturating the shifted result, which is what the vector gain functions implement.
+
+#include "squeezelite.h"
+
+#if PACK_SIMD
+
+typedef frames_t (*pack_kernel)(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity);
+
+#if DSD
+#define PACK_FORMATS (U32_BE + 1)
+#else
+#define PACK_FORMATS (FLOAT_LE + 1)
+#endif
+
+typedef frames_t (*gain_kernel)(s32_t *ptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags);
+typedef frames_t (*cross_kernel)(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t gain_in, s32_t gain_out);
+typedef frames_t (*ramp_kernel)(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t accL, s32_t accR, s32_t stepL, s32_t stepR);
+typedef frames_t (*cross_ramp_kernel)(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t acc_in, s32_t acc_out,
+									  s32_t step_in, s32_t step_out);
+typedef frames_t (*dither_kernel)(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, s32_t mask, u32_t *seed);
+
+static pack_kernel kernels[PACK_FORMATS];
+static gain_kernel gain_k;
+static cross_kernel cross_k;
+static ramp_kernel ramp_k;
+static cross_ramp_kernel cross_ramp_k;
+static dither_kernel dither_k;
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+static inline void store32(u8_t *optr, u32_t w) {
+	memcpy(optr, &w, 4);
+}
+
+// sse2 has no signed 32x32->64 multiply or 64 bit compare: form the unsigned products, correct the high words for
+// sign and saturate the 32 bit result from the high word
+SSE2 static inline __m128i gain_sse2(__m128i x, __m128i g) {
+	__m128i pe = _mm_mul_epu32(x, g);
+	__m128i po = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(g, 32));
+	__m128i e = _mm_shuffle_epi32(pe, _MM_SHUFFLE(3, 1, 2, 0));
+	__m128i o = _mm_shuffle_epi32(po, _MM_SHUFFLE(3, 1, 2, 0));
+	__m128i lo = _mm_unpacklo_epi32(e, o);
+	__m128i hi = _mm_unpackhi_epi32(e, o);
+	__m128i r, t, pos, neg;
+	hi = _mm_sub_epi32(hi, _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(x, 31), g), _mm_and_si128(_mm_srai_epi32(g, 31), x)));
+	r = _mm_or_si128(_mm_srli_epi32(lo, 16), _mm_slli_epi32(hi, 16));
+	t = _mm_srai_epi32(hi, 15);
+	pos = _mm_cmpgt_epi32(t, _mm_setzero_si128());
+	neg = _mm_cmplt_epi32(t, _mm_set1_epi32(-1));
+	r = _mm_andnot_si128(_mm_or_si128(pos, neg), r);
+	return _mm_or_si128(r, _mm_or_si128(_mm_and_si128(pos, _mm_set1_epi32(0x7fffffff)), _mm_and_si128(neg, _mm_set1_epi32((int)0x80000000))));
+}
+
+SSE2 static inline __m128i load_sse2(const s32_t *iptr, __m128i g, bool unity) {
+	__m128i x = _mm_loadu_si128((const __m128i *)(const void *)iptr);
+	return unity ? x : gain_sse2(x, g);
+}
+
+SSE2 static frames_t pack_s32_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m128i g = _mm_set_epi32(gainR, gainL, gainR, gainL);
+	frames_t i, n = cnt & ~1;
+	if (unity) return 0; // memcpy
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		_mm_storeu_si128((__m128i *)(void *)optr, gain_sse2(_mm_loadu_si128((const __m128i *)(const void *)iptr), g));
+	}
+	return n;
+}
+
+SSE2 static frames_t pack_s24_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m128i g = _mm_set_epi32(gainR, gainL, gainR, gainL);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm_srai_epi32(load_sse2(iptr, g, unity), 8));
+	}
+	return n;
+}
+
+SSE2 static frames_t pack_s24_3_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m128i g = _mm_set_epi32(gainR, gainL, gainR, gainL);
+	__m128i m32 = _mm_set_epi32(0, -1, 0, -1), m64 = _mm_set_epi32(0, 0, -1, -1);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 12) {
+		// drop the low byte of each sample then close up the 3 byte samples, first within and then across qwords
+		__m128i y = _mm_srli_epi32(load_sse2(iptr, g, unity), 8);
+		y = _mm_or_si128(_mm_and_si128(y, m32), _mm_srli_epi64(_mm_andnot_si128(m32, y), 8));
+		y = _mm_or_si128(_mm_and_si128(y, m64), _mm_srli_si128(_mm_andnot_si128(m64, y), 2));
+		_mm_storel_epi64((__m128i *)(void *)optr, y);
+		store32(optr + 8, _mm_cvtsi128_si32(_mm_srli_si128(y, 8)));
+	}
+	return n;
+}
+
+SSE2 static frames_t pack_s16_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m128i g = _mm_set_epi32(gainR, gainL, gainR, gainL);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 16) {
+		__m128i a = _mm_srai_epi32(load_sse2(iptr, g, unity), 16);
+		__m128i b = _mm_srai_epi32(load_sse2(iptr + 4, g, unity), 16);
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm_packs_epi32(a, b));
+	}
+	return n;
+}
+
+SSE2 static frames_t pack_float_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	float sl = (float)(unity ? FIXED_ONE : gainL) * FLOAT_GAIN_SCALE, sr = (float)(unity ? FIXED_ONE : gainR) * FLOAT_GAIN_SCALE;
+	__m128 s = _mm_set_ps(sr, sl, sr, sl);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		__m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(const void *)iptr));
+		_mm_storeu_ps((float *)(void *)optr, _mm_mul_ps(x, s));
+	}
+	return n;
+}
+
+// mono flags as the scalar code: a channel copied to both or the halved sum of both after gain
+SSE2 static frames_t gain_sse2_frames(s32_t *ptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags) {
+	frames_t i, n = cnt & ~1;
+	__m128i g = _mm_set_epi32(gainR, gainL, gainR, gainL);
+	for (i = 0; i < n; i += 2, ptr += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(const void *)ptr);
+		if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+			x = gain_sse2(x, g);
+			x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+			x = _mm_srai_epi32(_mm_add_epi32(x, _mm_srli_epi32(x, 31)), 1);
+		} else if (flags & MONO_RIGHT) {
+			x = gain_sse2(_mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 1, 1)), _mm_set1_epi32(gainR));
+		} else if (flags & MONO_LEFT) {
+			x = gain_sse2(_mm_shuffle_epi32(x, _MM_SHUFFLE(2, 2, 0, 0)), _mm_set1_epi32(gainL));
+		} else {
+			x = gain_sse2(x, g);
+		}
+		_mm_storeu_si128((__m128i *)(void *)ptr, x);
+	}
+	return n;
+}
+
+SSE2 static frames_t cross_sse2(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t gain_in, s32_t gain_out) {
+	__m128i gi = _mm_set1_epi32(gain_in), go = _mm_set1_epi32(gain_out);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, optr += 4, iptr += 4, cross_ptr += 4) {
+		__m128i a = gain_sse2(_mm_loadu_si128((const __m128i *)(const void *)iptr), go);
+		__m128i b = gain_sse2(_mm_loadu_si128((const __m128i *)(const void *)cross_ptr), gi);
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm_add_epi32(a, b));
+	}
+	return n;
+}
+
+SSE2 static inline __m128i xorshift_sse2(__m128i x) {
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+// tpdf dither as dither_frames in output_pack.c, a prng lane per sample
+SSE2 static frames_t dither_sse2(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, s32_t mask, u32_t *seed) {
+	__m128i g = _mm_set_epi32(gainR, gainL, gainR, gainL);
+	__m128i m = _mm_set1_epi32(mask), half = _mm_set1_epi32((mask + 1) / 2);
+	__m128i top = _mm_set1_epi32(0x3fffffff & ~mask), bot = _mm_set1_epi32(-0x40000000);
+	__m128i r = _mm_loadu_si128((const __m128i *)(const void *)seed);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 4) {
+		__m128i v = _mm_srai_epi32(gain_sse2(_mm_loadu_si128((const __m128i *)(const void *)iptr), g), 1);
+		__m128i c;
+		r = xorshift_sse2(r);
+		v = _mm_add_epi32(v, _mm_sub_epi32(_mm_and_si128(r, m), _mm_and_si128(_mm_srli_epi32(r, 16), m)));
+		v = _mm_andnot_si128(m, _mm_add_epi32(v, half));
+		c = _mm_cmpgt_epi32(v, top);
+		v = _mm_or_si128(_mm_and_si128(c, top), _mm_andnot_si128(c, v));
+		c = _mm_cmplt_epi32(v, bot);
+		v = _mm_or_si128(_mm_and_si128(c, bot), _mm_andnot_si128(c, v));
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm_slli_epi32(v, 1));
+	}
+	_mm_storeu_si128((__m128i *)(void *)seed, r);
+	return n;
+}
+
+// ramped gains, a lane of acc for each sample of two frames
+SSE2 static frames_t ramp_sse2(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t accL, s32_t accR, s32_t stepL, s32_t stepR) {
+	__m128i acc = _mm_set_epi32(accR + stepR, accL + stepL, accR, accL);
+	__m128i step = _mm_set_epi32(2 * stepR, 2 * stepL, 2 * stepR, 2 * stepL);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(const void *)iptr);
+		_mm_storeu_si128((__m128i *)(void *)optr, gain_sse2(x, _mm_srai_epi32(acc, RAMP_SHIFT)));
+		acc = _mm_add_epi32(acc, step);
+	}
+	return n;
+}
+
+SSE2 static frames_t cross_ramp_sse2(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t acc_in, s32_t acc_out,
+									 s32_t step_in, s32_t step_out) {
+	__m128i ai = _mm_set_epi32(acc_in + step_in, acc_in + step_in, acc_in, acc_in);
+	__m128i ao = _mm_set_epi32(acc_out + step_out, acc_out + step_out, acc_out, acc_out);
+	__m128i si = _mm_set1_epi32(2 * step_in), so = _mm_set1_epi32(2 * step_out);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, optr += 4, iptr += 4, cross_ptr += 4) {
+		__m128i a = gain_sse2(_mm_loadu_si128((const __m128i *)(const void *)iptr), _mm_srai_epi32(ao, RAMP_SHIFT));
+		__m128i b = gain_sse2(_mm_loadu_si128((const __m128i *)(const void *)cross_ptr), _mm_srai_epi32(ai, RAMP_SHIFT));
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm_add_epi32(a, b));
+		ai = _mm_add_epi32(ai, si);
+		ao = _mm_add_epi32(ao, so);
+	}
+	return n;
+}
+
+#if DSD
+SSE2 static frames_t pack_u8_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	frames_t i, n = cnt & ~7;
+	for (i = 0; i < n; i += 8, iptr += 16, optr += 16) {
+		__m128i a = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(const void *)iptr), 24);
+		__m128i b = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(const void *)(iptr + 4)), 24);
+		__m128i c = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(const void *)(iptr + 8)), 24);
+		__m128i d = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(const void *)(iptr + 12)), 24);
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+	return n;
+}
+
+SSE2 static frames_t pack_u16_le_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	return pack_s16_sse2(optr, iptr, cnt, FIXED_ONE, FIXED_ONE, true);
+}
+
+SSE2 static frames_t pack_u16_be_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 16) {
+		__m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(const void *)iptr), 16);
+		__m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(const void *)(iptr + 4)), 16);
+		__m128i p = _mm_packs_epi32(a, b);
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8)));
+	}
+	return n;
+}
+
+SSE2 static frames_t pack_u32_be_sse2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m128i m = _mm_set1_epi32(0x00ff00ff);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(const void *)iptr);
+		// swap bytes within each half then the halves
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 8), m), _mm_slli_epi32(_mm_and_si128(x, m), 8));
+		x = _mm_or_si128(_mm_srli_epi32(x, 16), _mm_slli_epi32(x, 16));
+		_mm_storeu_si128((__m128i *)(void *)optr, x);
+	}
+	return n;
+}
+#endif
+
+// avx2 has the signed multiply, the rest is as sse2 within each 128 bit lane
+AVX2 static inline __m256i gain_avx2(__m256i x, __m256i g) {
+	__m256i pe = _mm256_mul_epi32(x, g);
+	__m256i po = _mm256_mul_epi32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(g, 32));
+	__m256i e = _mm256_shuffle_epi32(pe, _MM_SHUFFLE(3, 1, 2, 0));
+	__m256i o = _mm256_shuffle_epi32(po, _MM_SHUFFLE(3, 1, 2, 0));
+	__m256i lo = _mm256_unpacklo_epi32(e, o);
+	__m256i hi = _mm256_unpackhi_epi32(e, o);
+	__m256i r = _mm256_or_si256(_mm256_srli_epi32(lo, 16), _mm256_slli_epi32(hi, 16));
+	__m256i t = _mm256_srai_epi32(hi, 15);
+	__m256i pos = _mm256_cmpgt_epi32(t, _mm256_setzero_si256());
+	__m256i neg = _mm256_cmpgt_epi32(_mm256_set1_epi32(-1), t);
+	r = _mm256_blendv_epi8(r, _mm256_set1_epi32(0x7fffffff), pos);
+	return _mm256_blendv_epi8(r, _mm256_set1_epi32((int)0x80000000), neg);
+}
+
+AVX2 static inline __m256i load_avx2(const s32_t *iptr, __m256i g, bool unity) {
+	__m256i x = _mm256_loadu_si256((const __m256i *)(const void *)iptr);
+	return unity ? x : gain_avx2(x, g);
+}
+
+AVX2 static frames_t pack_s32_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m256i g = _mm256_set_epi32(gainR, gainL, gainR, gainL, gainR, gainL, gainR, gainL);
+	frames_t i, n = cnt & ~3;
+	if (unity) return 0; // memcpy
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 32) {
+		_mm256_storeu_si256((__m256i *)(void *)optr, gain_avx2(_mm256_loadu_si256((const __m256i *)(const void *)iptr), g));
+	}
+	return n;
+}
+
+AVX2 static frames_t pack_s24_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m256i g = _mm256_set_epi32(gainR, gainL, gainR, gainL, gainR, gainL, gainR, gainL);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 32) {
+		_mm256_storeu_si256((__m256i *)(void *)optr, _mm256_srai_epi32(load_avx2(iptr, g, unity), 8));
+	}
+	return n;
+}
+
+AVX2 static frames_t pack_s24_3_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m256i g = _mm256_set_epi32(gainR, gainL, gainR, gainL, gainR, gainL, gainR, gainL);
+	__m256i shuf = _mm256_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1,
+									1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+	__m256i perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 24) {
+		// 12 bytes per lane, then close the gap between lanes
+		__m256i y = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(load_avx2(iptr, g, unity), shuf), perm);
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm256_castsi256_si128(y));
+		_mm_storel_epi64((__m128i *)(void *)(optr + 16), _mm256_extracti128_si256(y, 1));
+	}
+	return n;
+}
+
+AVX2 static frames_t pack_s16_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m256i g = _mm256_set_epi32(gainR, gainL, gainR, gainL, gainR, gainL, gainR, gainL);
+	frames_t i, n = cnt & ~7;
+	for (i = 0; i < n; i += 8, iptr += 16, optr += 32) {
+		__m256i a = _mm256_srai_epi32(load_avx2(iptr, g, unity), 16);
+		__m256i b = _mm256_srai_epi32(load_avx2(iptr + 8, g, unity), 16);
+		_mm256_storeu_si256((__m256i *)(void *)optr, _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return n;
+}
+
+AVX2 static frames_t pack_float_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	float sl = (float)(unity ? FIXED_ONE : gainL) * FLOAT_GAIN_SCALE, sr = (float)(unity ? FIXED_ONE : gainR) * FLOAT_GAIN_SCALE;
+	__m256 s = _mm256_set_ps(sr, sl, sr, sl, sr, sl, sr, sl);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 32) {
+		__m256 x = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(const void *)iptr));
+		_mm256_storeu_ps((float *)(void *)optr, _mm256_mul_ps(x, s));
+	}
+	return n;
+}
+
+AVX2 static frames_t gain_avx2_frames(s32_t *ptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags) {
+	frames_t i, n = cnt & ~3;
+	__m256i g = _mm256_set_epi32(gainR, gainL, gainR, gainL, gainR, gainL, gainR, gainL);
+	for (i = 0; i < n; i += 4, ptr += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(const void *)ptr);
+		if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+			x = gain_avx2(x, g);
+			x = _mm256_add_epi32(x, _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+			x = _mm256_srai_epi32(_mm256_add_epi32(x, _mm256_srli_epi32(x, 31)), 1);
+		} else if (flags & MONO_RIGHT) {
+			x = gain_avx2(_mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 1, 1)), _mm256_set1_epi32(gainR));
+		} else if (flags & MONO_LEFT) {
+			x = gain_avx2(_mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 2, 0, 0)), _mm256_set1_epi32(gainL));
+		} else {
+			x = gain_avx2(x, g);
+		}
+		_mm256_storeu_si256((__m256i *)(void *)ptr, x);
+	}
+	return n;
+}
+
+AVX2 static frames_t cross_avx2(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t gain_in, s32_t gain_out) {
+	__m256i gi = _mm256_set1_epi32(gain_in), go = _mm256_set1_epi32(gain_out);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, optr += 8, iptr += 8, cross_ptr += 8) {
+		__m256i a = gain_avx2(_mm256_loadu_si256((const __m256i *)(const void *)iptr), go);
+		__m256i b = gain_avx2(_mm256_loadu_si256((const __m256i *)(const void *)cross_ptr), gi);
+		_mm256_storeu_si256((__m256i *)(void *)optr, _mm256_add_epi32(a, b));
+	}
+	return n;
+}
+
+// as sse2 with eight prng lanes, so the dither sequence (unlike the result of each sample) differs from the scalar code
+AVX2 static frames_t dither_avx2(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, s32_t mask, u32_t *seed) {
+	__m256i g = _mm256_set_epi32(gainR, gainL, gainR, gainL, gainR, gainL, gainR, gainL);
+	__m256i m = _mm256_set1_epi32(mask), half = _mm256_set1_epi32((mask + 1) / 2);
+	__m256i top = _mm256_set1_epi32(0x3fffffff & ~mask), bot = _mm256_set1_epi32(-0x40000000);
+	__m256i r = _mm256_loadu_si256((const __m256i *)(const void *)seed);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 8) {
+		__m256i v = _mm256_srai_epi32(gain_avx2(_mm256_loadu_si256((const __m256i *)(const void *)iptr), g), 1);
+		r = _mm256_xor_si256(r, _mm256_slli_epi32(r, 13));
+		r = _mm256_xor_si256(r, _mm256_srli_epi32(r, 17));
+		r = _mm256_xor_si256(r, _mm256_slli_epi32(r, 5));
+		v = _mm256_add_epi32(v, _mm256_sub_epi32(_mm256_and_si256(r, m), _mm256_and_si256(_mm256_srli_epi32(r, 16), m)));
+		v = _mm256_andnot_si256(m, _mm256_add_epi32(v, half));
+		v = _mm256_max_epi32(_mm256_min_epi32(v, top), bot);
+		_mm256_storeu_si256((__m256i *)(void *)optr, _mm256_slli_epi32(v, 1));
+	}
+	_mm256_storeu_si256((__m256i *)(void *)seed, r);
+	return n;
+}
+
+AVX2 static frames_t ramp_avx2(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t accL, s32_t accR, s32_t stepL, s32_t stepR) {
+	__m256i acc = _mm256_add_epi32(_mm256_set_epi32(accR, accL, accR, accL, accR, accL, accR, accL),
+								   _mm256_mullo_epi32(_mm256_set_epi32(stepR, stepL, stepR, stepL, stepR, stepL, stepR, stepL),
+													  _mm256_set_epi32(3, 3, 2, 2, 1, 1, 0, 0)));
+	__m256i step = _mm256_set_epi32(4 * stepR, 4 * stepL, 4 * stepR, 4 * stepL, 4 * stepR, 4 * stepL, 4 * stepR, 4 * stepL);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(const void *)iptr);
+		_mm256_storeu_si256((__m256i *)(void *)optr, gain_avx2(x, _mm256_srai_epi32(acc, RAMP_SHIFT)));
+		acc = _mm256_add_epi32(acc, step);
+	}
+	return n;
+}
+
+AVX2 static frames_t cross_ramp_avx2(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t acc_in, s32_t acc_out,
+									 s32_t step_in, s32_t step_out) {
+	__m256i f = _mm256_set_epi32(3, 3, 2, 2, 1, 1, 0, 0);
+	__m256i ai = _mm256_add_epi32(_mm256_set1_epi32(acc_in), _mm256_mullo_epi32(_mm256_set1_epi32(step_in), f));
+	__m256i ao = _mm256_add_epi32(_mm256_set1_epi32(acc_out), _mm256_mullo_epi32(_mm256_set1_epi32(step_out), f));
+	__m256i si = _mm256_set1_epi32(4 * step_in), so = _mm256_set1_epi32(4 * step_out);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, optr += 8, iptr += 8, cross_ptr += 8) {
+		__m256i a = gain_avx2(_mm256_loadu_si256((const __m256i *)(const void *)iptr), _mm256_srai_epi32(ao, RAMP_SHIFT));
+		__m256i b = gain_avx2(_mm256_loadu_si256((const __m256i *)(const void *)cross_ptr), _mm256_srai_epi32(ai, RAMP_SHIFT));
+		_mm256_storeu_si256((__m256i *)(void *)optr, _mm256_add_epi32(a, b));
+		ai = _mm256_add_epi32(ai, si);
+		ao = _mm256_add_epi32(ao, so);
+	}
+	return n;
+}
+
+#if DSD
+AVX2 static frames_t pack_u8_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	frames_t i, n = cnt & ~15;
+	for (i = 0; i < n; i += 16, iptr += 32, optr += 32) {
+		__m256i a = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(const void *)iptr), 24);
+		__m256i b = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(const void *)(iptr + 8)), 24);
+		__m256i c = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(const void *)(iptr + 16)), 24);
+		__m256i d = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(const void *)(iptr + 24)), 24);
+		__m256i p = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		_mm256_storeu_si256((__m256i *)(void *)optr, _mm256_permutevar8x32_epi32(p, perm));
+	}
+	return n;
+}
+
+AVX2 static frames_t pack_u16_le_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	return pack_s16_avx2(optr, iptr, cnt, FIXED_ONE, FIXED_ONE, true);
+}
+
+AVX2 static frames_t pack_u16_be_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m256i shuf = _mm256_setr_epi8(3, 2, 7, 6, 11, 10, 15, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+									3, 2, 7, 6, 11, 10, 15, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 16) {
+		__m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(const void *)iptr), shuf);
+		_mm_storeu_si128((__m128i *)(void *)optr, _mm256_castsi256_si128(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0))));
+	}
+	return n;
+}
+
+AVX2 static frames_t pack_u32_be_avx2(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	__m256i shuf = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+									3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 32) {
+		_mm256_storeu_si256((__m256i *)(void *)optr, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(const void *)iptr), shuf));
+	}
+	return n;
+}
+#endif
+
+static const char *select_x86(const char *isa) {
+	__builtin_cpu_init();
+	if ((!isa || !strcmp(isa, "avx2")) && __builtin_cpu_supports("avx2")) {
+		kernels[S32_LE] = pack_s32_avx2;
+		kernels[S24_LE] = pack_s24_avx2;
+		kernels[S24_3LE] = pack_s24_3_avx2;
+		kernels[S16_LE] = pack_s16_avx2;
+		kernels[FLOAT_LE] = pack_float_avx2;
+#if DSD
+		kernels[U8] = pack_u8_avx2;
+		kernels[U16_LE] = pack_u16_le_avx2;
+		kernels[U16_BE] = pack_u16_be_avx2;
+		kernels[U32_BE] = pack_u32_be_avx2;
+#endif
+		gain_k = gain_avx2_frames;
+		cross_k = cross_avx2;
+		ramp_k = ramp_avx2;
+		cross_ramp_k = cross_ramp_avx2;
+		dither_k = dither_avx2;
+		return "avx2";
+	}
+	if ((!isa || !strcmp(isa, "sse2")) && __builtin_cpu_supports("sse2")) {
+		kernels[S32_LE] = pack_s32_sse2;
+		kernels[S24_LE] = pack_s24_sse2;
+		kernels[S24_3LE] = pack_s24_3_sse2;
+		kernels[S16_LE] = pack_s16_sse2;
+		kernels[FLOAT_LE] = pack_float_sse2;
+#if DSD
+		kernels[U8] = pack_u8_sse2;
+		kernels[U16_LE] = pack_u16_le_sse2;
+		kernels[U16_BE] = pack_u16_be_sse2;
+		kernels[U32_BE] = pack_u32_be_sse2;
+#endif
+		gain_k = gain_sse2_frames;
+		cross_k = cross_sse2;
+		ramp_k = ramp_sse2;
+		cross_ramp_k = cross_ramp_sse2;
+		dither_k = dither_sse2;
+		return "sse2";
+	}
+	return NULL;
+}
+
+#endif // x86
+
+#if defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+#if LINUX
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// vqshrn saturates the shifted 64 bit product exactly as the scalar clamp does
+static inline int32x4_t gain_neon(int32x4_t x, int32x2_t g) {
+	return vcombine_s32(vqshrn_n_s64(vmull_s32(vget_low_s32(x), g), 16), vqshrn_n_s64(vmull_s32(vget_high_s32(x), g), 16));
+}
+
+static inline int32x4_t load_neon(const s32_t *iptr, int32x2_t g, bool unity) {
+	int32x4_t x = vld1q_s32(iptr);
+	return unity ? x : gain_neon(x, g);
+}
+
+static inline int32x2_t gains_neon(s32_t gainL, s32_t gainR) {
+	return vset_lane_s32(gainR, vdup_n_s32(gainL), 1);
+}
+
+static frames_t pack_s32_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	int32x2_t g = gains_neon(gainL, gainR);
+	frames_t i, n = cnt & ~1;
+	if (unity) return 0; // memcpy
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		vst1q_s32((int32_t *)(void *)optr, gain_neon(vld1q_s32(iptr), g));
+	}
+	return n;
+}
+
+static frames_t pack_s24_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	int32x2_t g = gains_neon(gainL, gainR);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		vst1q_s32((int32_t *)(void *)optr, vshrq_n_s32(load_neon(iptr, g, unity), 8));
+	}
+	return n;
+}
+
+static frames_t pack_s24_3_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	static const u8_t lo[8] = { 1, 2, 3, 5, 6, 7, 9, 10 }, hi[8] = { 11, 13, 14, 15, 255, 255, 255, 255 };
+	int32x2_t g = gains_neon(gainL, gainR);
+	uint8x8_t tlo = vld1_u8(lo), thi = vld1_u8(hi);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 12) {
+		uint8x16_t x = vreinterpretq_u8_s32(load_neon(iptr, g, unity));
+		uint8x8x2_t t = { { vget_low_u8(x), vget_high_u8(x) } };
+		u32_t w = vget_lane_u32(vreinterpret_u32_u8(vtbl2_u8(t, thi)), 0);
+		vst1_u8(optr, vtbl2_u8(t, tlo));
+		memcpy(optr + 8, &w, 4);
+	}
+	return n;
+}
+
+static frames_t pack_s16_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	int32x2_t g = gains_neon(gainL, gainR);
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 16) {
+		int16x8_t p = vcombine_s16(vshrn_n_s32(load_neon(iptr, g, unity), 16), vshrn_n_s32(load_neon(iptr + 4, g, unity), 16));
+		vst1q_s16((int16_t *)(void *)optr, p);
+	}
+	return n;
+}
+
+static frames_t pack_float_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	float sl = (float)(unity ? FIXED_ONE : gainL) * FLOAT_GAIN_SCALE, sr = (float)(unity ? FIXED_ONE : gainR) * FLOAT_GAIN_SCALE;
+	float32x4_t s = vcombine_f32(vset_lane_f32(sr, vdup_n_f32(sl), 1), vset_lane_f32(sr, vdup_n_f32(sl), 1));
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		vst1q_f32((float *)(void *)optr, vmulq_f32(vcvtq_f32_s32(vld1q_s32(iptr)), s));
+	}
+	return n;
+}
+
+static frames_t gain_neon_frames(s32_t *ptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags) {
+	int32x2_t g = gains_neon(gainL, gainR);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, ptr += 4) {
+		int32x4_t x = vld1q_s32(ptr);
+		if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+			x = gain_neon(x, g);
+			x = vaddq_s32(x, vrev64q_s32(x));
+			x = vshrq_n_s32(vaddq_s32(x, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(x), 31))), 1);
+		} else if (flags & MONO_RIGHT) {
+			x = gain_neon(vtrnq_s32(x, x).val[1], vdup_n_s32(gainR));
+		} else if (flags & MONO_LEFT) {
+			x = gain_neon(vtrnq_s32(x, x).val[0], vdup_n_s32(gainL));
+		} else {
+			x = gain_neon(x, g);
+		}
+		vst1q_s32(ptr, x);
+	}
+	return n;
+}
+
+static frames_t cross_neon(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t gain_in, s32_t gain_out) {
+	int32x2_t gi = vdup_n_s32(gain_in), go = vdup_n_s32(gain_out);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, optr += 4, iptr += 4, cross_ptr += 4) {
+		vst1q_s32(optr, vaddq_s32(gain_neon(vld1q_s32(iptr), go), gain_neon(vld1q_s32(cross_ptr), gi)));
+	}
+	return n;
+}
+
+static frames_t dither_neon(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, s32_t mask, u32_t *seed) {
+	int32x2_t g = gains_neon(gainL, gainR);
+	int32x4_t m = vdupq_n_s32(mask), half = vdupq_n_s32((mask + 1) / 2);
+	int32x4_t top = vdupq_n_s32(0x3fffffff & ~mask), bot = vdupq_n_s32(-0x40000000);
+	uint32x4_t r = vld1q_u32(seed);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 4) {
+		int32x4_t v = vshrq_n_s32(gain_neon(vld1q_s32(iptr), g), 1);
+		int32x4_t d;
+		r = veorq_u32(r, vshlq_n_u32(r, 13));
+		r = veorq_u32(r, vshrq_n_u32(r, 17));
+		r = veorq_u32(r, vshlq_n_u32(r, 5));
+		d = vsubq_s32(vandq_s32(vreinterpretq_s32_u32(r), m), vandq_s32(vreinterpretq_s32_u32(vshrq_n_u32(r, 16)), m));
+		v = vbicq_s32(vaddq_s32(vaddq_s32(v, d), half), m);
+		v = vmaxq_s32(vminq_s32(v, top), bot);
+		vst1q_s32(optr, vshlq_n_s32(v, 1));
+	}
+	vst1q_u32(seed, r);
+	return n;
+}
+
+// per lane gains
+static inline int32x4_t gainv_neon(int32x4_t x, int32x4_t g) {
+	return vcombine_s32(vqshrn_n_s64(vmull_s32(vget_low_s32(x), vget_low_s32(g)), 16),
+						vqshrn_n_s64(vmull_s32(vget_high_s32(x), vget_high_s32(g)), 16));
+}
+
+static frames_t ramp_neon(s32_t *optr, const s32_t *iptr, frames_t cnt, s32_t accL, s32_t accR, s32_t stepL, s32_t stepR) {
+	s32_t a[4] = { accL, accR, accL + stepL, accR + stepR }, st[4] = { 2 * stepL, 2 * stepR, 2 * stepL, 2 * stepR };
+	int32x4_t acc = vld1q_s32(a), step = vld1q_s32(st);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 4) {
+		vst1q_s32(optr, gainv_neon(vld1q_s32(iptr), vshrq_n_s32(acc, RAMP_SHIFT)));
+		acc = vaddq_s32(acc, step);
+	}
+	return n;
+}
+
+static frames_t cross_ramp_neon(s32_t *optr, const s32_t *iptr, const s32_t *cross_ptr, frames_t cnt, s32_t acc_in, s32_t acc_out,
+								s32_t step_in, s32_t step_out) {
+	s32_t a[4] = { acc_in, acc_in, acc_in + step_in, acc_in + step_in }, b[4] = { acc_out, acc_out, acc_out + step_out, acc_out + step_out };
+	int32x4_t ai = vld1q_s32(a), ao = vld1q_s32(b), si = vdupq_n_s32(2 * step_in), so = vdupq_n_s32(2 * step_out);
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, optr += 4, iptr += 4, cross_ptr += 4) {
+		vst1q_s32(optr, vaddq_s32(gainv_neon(vld1q_s32(iptr), vshrq_n_s32(ao, RAMP_SHIFT)),
+								  gainv_neon(vld1q_s32(cross_ptr), vshrq_n_s32(ai, RAMP_SHIFT))));
+		ai = vaddq_s32(ai, si);
+		ao = vaddq_s32(ao, so);
+	}
+	return n;
+}
+
+#if DSD
+static frames_t pack_u8_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	const u32_t *ip = (const u32_t *)(const void *)iptr;
+	frames_t i, n = cnt & ~7;
+	for (i = 0; i < n; i += 8, ip += 16, optr += 16) {
+		uint16x8_t a = vcombine_u16(vshrn_n_u32(vld1q_u32(ip), 16), vshrn_n_u32(vld1q_u32(ip + 4), 16));
+		uint16x8_t b = vcombine_u16(vshrn_n_u32(vld1q_u32(ip + 8), 16), vshrn_n_u32(vld1q_u32(ip + 12), 16));
+		vst1q_u8(optr, vcombine_u8(vshrn_n_u16(a, 8), vshrn_n_u16(b, 8)));
+	}
+	return n;
+}
+
+static frames_t pack_u16_le_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	return pack_s16_neon(optr, iptr, cnt, FIXED_ONE, FIXED_ONE, true);
+}
+
+static frames_t pack_u16_be_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	frames_t i, n = cnt & ~3;
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 16) {
+		int16x8_t p = vcombine_s16(vshrn_n_s32(vld1q_s32(iptr), 16), vshrn_n_s32(vld1q_s32(iptr + 4), 16));
+		vst1q_u8(optr, vrev16q_u8(vreinterpretq_u8_s16(p)));
+	}
+	return n;
+}
+
+static frames_t pack_u32_be_neon(u8_t *optr, const s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, bool unity) {
+	frames_t i, n = cnt & ~1;
+	for (i = 0; i < n; i += 2, iptr += 4, optr += 16) {
+		vst1q_u8(optr, vrev32q_u8(vreinterpretq_u8_s32(vld1q_s32(iptr))));
+	}
+	return n;
+}
+#endif
+
+static const char *select_neon(const char *isa) {
+	if (isa && strcmp(isa, "neon")) {
+		return NULL;
+	}
+#if LINUX && defined(__aarch64__)
+	if (!(getauxval(AT_HWCAP) & HWCAP_ASIMD)) return NULL;
+#elif LINUX
+	if (!(getauxval(AT_HWCAP) & HWCAP_NEON)) return NULL;
+#endif
+	kernels[S32_LE] = pack_s32_neon;
+	kernels[S24_LE] = pack_s24_neon;
+	kernels[S24_3LE] = pack_s24_3_neon;
+	kernels[S16_LE] = pack_s16_neon;
+	kernels[FLOAT_LE] = pack_float_neon;
+#if DSD
+	kernels[U8] = pack_u8_neon;
+	kernels[U16_LE] = pack_u16_le_neon;
+	kernels[U16_BE] = pack_u16_be_neon;
+	kernels[U32_BE] = pack_u32_be_neon;
+#endif
+	gain_k = gain_neon_frames;
+	cross_k = cross_neon;
+	ramp_k = ramp_neon;
+	cross_ramp_k = cross_ramp_neon;
+	dither_k = dither_neon;
+	return "neon";
+}
+
+#endif // neon
+
+// select kernels for the best isa the cpu supports, or only isa if set ("scalar" disables them)
+// returns the isa selected, NULL if isa is not available
+const char *pack_simd_init(const char *isa) {
+	const char *sel = NULL;
+
+	memset(kernels, 0, sizeof(kernels));
+	gain_k = NULL;
+	cross_k = NULL;
+	ramp_k = NULL;
+	cross_ramp_k = NULL;
+	dither_k = NULL;
+
+	if (isa && !strcmp(isa, "scalar")) {
+		return isa;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	sel = select_x86(isa);
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+	sel = select_neon(isa);
+#endif
+
+	return sel ? sel : (isa ? NULL : "scalar");
+}
+
+// pack as many frames as the kernel for format handles, returning how many, the caller packs the rest
+frames_t _scale_and_pack_simd(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, output_format format, bool unity) {
+	pack_kernel k = (unsigned)format < PACK_FORMATS ? kernels[format] : NULL;
+	return k ? k(outputptr, inputptr, cnt, gainL, gainR, unity) : 0;
+}
+
+// gain and mono flags applied in place to outputbuf samples, returning the frames processed
+frames_t _apply_gain_simd(s32_t *ptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags) {
+	return gain_k ? gain_k(ptr, cnt, gainL, gainR, flags) : 0;
+}
+
+// crossfade mix of iptr and a contiguous run of cross_ptr to optr (which may be iptr), returning the frames processed
+frames_t _apply_cross_simd(s32_t *optr, s32_t *iptr, s32_t *cross_ptr, frames_t cnt, s32_t cross_gain_in, s32_t cross_gain_out) {
+	return cross_k ? cross_k(optr, iptr, cross_ptr, cnt, cross_gain_in, cross_gain_out) : 0;
+}
+
+// per frame ramped gains of iptr to optr (which may be iptr), acc being the gains << RAMP_SHIFT of the first frame,
+// returning the frames processed
+frames_t _gain_ramp_simd(s32_t *optr, s32_t *iptr, frames_t cnt, s32_t accL, s32_t accR, s32_t stepL, s32_t stepR) {
+	return ramp_k ? ramp_k(optr, iptr, cnt, accL, accR, stepL, stepR) : 0;
+}
+
+// crossfade mix as _apply_cross_simd with ramped gains, returning the frames processed
+frames_t _cross_ramp_simd(s32_t *optr, s32_t *iptr, s32_t *cross_ptr, frames_t cnt, s32_t acc_in, s32_t acc_out, s32_t step_in, s32_t step_out) {
+	return cross_ramp_k ? cross_ramp_k(optr, iptr, cross_ptr, cnt, acc_in, acc_out, step_in, step_out) : 0;
+}
+
+// gain and tpdf dither of iptr to optr as dither_frames, advancing the prng lanes in seed, returning the frames processed
+frames_t _dither_simd(s32_t *optr, s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, s32_t mask, u32_t seed[8]) {
+	return dither_k ? dither_k(optr, iptr, cnt, gainL, gainR, mask, seed) : 0;
+}
+
+#endif // PACK_SIMD
@@ -59,7 +59,8 @@ struct __attribute__((packed)) sq_format_header {
 	u8_t  bit_depth;      // PCM: 16/24/32, Native DSD: 1, DoP: 24
 	u8_t  dsd_format;     // 0=PCM, 1=DOP, 2=DSD_U32_LE, 3=DSD_U32_BE
 	u32_t sample_rate;    // Sample/frame rate in Hz (little-endian)
-	u8_t  reserved[4];    // Reserved for future use, zero-filled
+	u8_t  sample_type;    // PCM: 0=integer, 1=IEEE float (bit_depth 32)
+	u8_t  reserved[3];    // Reserved for future use, zero-filled
 };
 
 #define SQ_HEADER_VERSION 1
@@ -102,42 +103,44 @@ static void build_format_header(struct sq_format_header *hdr) {
 		case S16_LE:  hdr->bit_depth = 16; break;
 		case S24_3LE: hdr->bit_depth = 24; break;
 		case S24_LE:  hdr->bit_depth = 24; break;
+		case FLOAT_LE: hdr->bit_depth = 32; hdr->sample_type = 1; break;
 		default:      hdr->bit_depth = 32; break;
 		}
 	}
 }
 
 static int _stdout_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
-								s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr) {
+								struct cross_mix *cross, const struct gain_ramp *ramp) {
 
 	u8_t *obuf;
 
 	if (!silence) {
 
-		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
-			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
-		}
-
 		obuf = outputbuf->readp;
 
 	} else {
 
 		obuf = silencebuf;
+		cross = NULL;
 	}
 
 	IF_DSD(
-		   if (output.outfmt != PCM) {
-			   if (silence) {
-				   obuf = silencebuf_dsd;
-			   }
-			   if (output.outfmt == DOP)
-				   update_dop((u32_t *)obuf, out_frames, output.invert && !silence);
-			   else if (output.invert && !silence)
-				   dsd_invert((u32_t *)obuf, out_frames);
+		   if (output.outfmt != PCM && silence) {
+			   obuf = silencebuf_dsd;
+			   if (flags & DSD_DOP)
+				   update_dop((u32_t *)obuf, out_frames, false);
 		   }
 	)
 
-	_scale_and_pack_frames(buf + buffill * bytes_per_frame, (s32_t *)(void *)obuf, out_frames, gainL, gainR, flags, output.format);
+	if (!silence && output.frame_bytes != BYTES_PER_FRAME && !cross) {
+		_scale_and_pack_frames16(buf + buffill * bytes_per_frame, (s16_t *)(void *)obuf, out_frames, gainL, gainR, flags, output.format, ramp);
+	} else if (!silence) {
+		// cross fade, dop markers / dsd invert, mono flags and gain applied in one pass with packing
+		_scale_and_pack_fused(&output.pack, buf + buffill * bytes_per_frame, (s32_t *)(void *)obuf, out_frames, gainL, gainR,
+							  outputbuf, cross, ramp);
+	} else {
+		_scale_and_pack_frames(buf + buffill * bytes_per_frame, (s32_t *)(void *)obuf, out_frames, gainL, gainR, 0, output.format);
+	}
 
 	buffill += out_frames;
 
@@ -258,12 +261,14 @@ void output_init_stdout(log_level level, unsigned output_buf_size, char *params,
 	output.format = S32_LE;
 	output.start_frames = FRAME_BLOCK * 2;
 	output.write_cb = &_stdout_write_frames;
+	output.narrow = true;
 	output.rate_delay = rate_delay;
 
 	if (params) {
 		if (!strcmp(params, "32"))	output.format = S32_LE;
 		if (!strcmp(params, "24")) output.format = S24_3LE;
 		if (!strcmp(params, "16")) output.format = S16_LE;
+		if (!strcmp(params, "float")) output.format = FLOAT_LE;
 	}
 
 	// ensure output rate is specified to avoid test open
@@ -99,7 +99,15 @@ void _vis_export(struct buffer *outputbuf, struct outputstate *output, frames_t
 				s32_t *ptr = (s32_t *) outputbuf->readp;
 				unsigned i = vis_mmap->buf_index;
 				
-				if (!output->current_replay_gain) {
+				if (output->frame_bytes != BYTES_PER_FRAME) {
+					// narrow frames are already 16 bit
+					s16_t *nptr = (s16_t *) outputbuf->readp;
+					while (vis_cnt--) {
+						vis_mmap->buffer[i++] = output->current_replay_gain ? gain(*(nptr++) << 16, output->current_replay_gain) >> 16 : *(nptr++);
+						vis_mmap->buffer[i++] = output->current_replay_gain ? gain(*(nptr++) << 16, output->current_replay_gain) >> 16 : *(nptr++);
+						if (i == VIS_BUF_SIZE) i = 0;
+					}
+				} else if (!output->current_replay_gain) {
 					while (vis_cnt--) {
 						vis_mmap->buffer[i++] = *(ptr++) >> 16;
 						vis_mmap->buffer[i++] = *(ptr++) >> 16;
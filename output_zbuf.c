@@ -0,0 +1,586 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2015, triode1@btinternet.com
+ *      Ralph Irving 2015-2025, ralph_irving@hotmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Compressed outputbuf - decoded audio held losslessly compressed until shortly before it is played
+
+// outputbuf keeps its normal layout so positions such as track starts and fades are unchanged, but it is an address
+// space several times the memory requested. The decode thread packs whole blocks well ahead of readp using a fixed
+// predictor and rice coding, then releases their pages. The output thread unpacks blocks back in place, in order,
+// one block ahead of what it is about to play. Packed data is held in a fifo as blocks are packed and played in order.
+
+#define _GNU_SOURCE
+
+#include "squeezelite.h"
+
+#if LINUX && !SUN
+
+#include <sys/mman.h>
+
+#define Z_BLOCK   (64 * 1024)   // raw bytes per block, a whole number of pages and of frames of either width
+#define Z_RATIO   4             // outputbuf address space as a multiple of the memory requested
+#define Z_RAW     (1024 * 1024) // memory kept for unpacked audio, the rest of that requested holds packed blocks
+#define Z_AHEAD   (2 * Z_BLOCK) // unpacked bytes kept ahead of readp
+#define Z_MAXPACK (Z_BLOCK * 3 / 4) // blocks which don't pack smaller than this are left unpacked
+#define Z_PART    256           // samples per rice partition
+#define Z_ESC     24            // rice quotients of this or more are escaped and the sample stored verbatim
+#define Z_PACKS   8             // most blocks packed per call to bound time away from decoding
+#define Z_STATS   256           // blocks unpacked between reports of compression and unpacking cost
+
+#define Z_MIXED   0xff          // width of a block with frames of more than one width, or not pcm
+
+static log_level loglevel;
+
+extern struct outputstate output;
+extern struct buffer *outputbuf;
+
+#define LOCK   mutex_lock(outputbuf->mutex)
+#define UNLOCK mutex_unlock(outputbuf->mutex)
+
+struct zblock {
+	u32_t zoff;   // offset of packed data in zmem
+	u32_t zlen;   // packed length, 0 if the block is unpacked
+	u8_t  width;  // bytes per frame written to the block - set by decode thread
+};
+
+static struct {
+	struct buffer *buf;
+	struct zblock *blocks;
+	unsigned nblocks;
+	u8_t  *zmem;
+	size_t zsize;
+	u8_t  zmem_mem;
+	size_t zhead;       // decode thread appends packed blocks here
+	size_t ztail;       // start of the oldest packed block
+	size_t zbytes;      // packed bytes held
+	unsigned npacked;   // packed blocks held
+	unsigned gen;       // incremented when packed blocks are discarded, so a block packed meanwhile is not committed
+	size_t budget;      // memory requested for outputbuf
+	unsigned packk;     // next block to consider packing - decode thread
+	unsigned dropk;     // block which contained readp when consumed blocks were last released - decode thread
+	// statistics
+	u64_t raw_bytes, packed_bytes, pack_ns, unpack_ns, unpack_frames;
+	unsigned packs, unpacks, reported;
+} z;
+
+static inline u64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// bytes from a to b going forward round outputbuf
+static inline size_t dist(u8_t *a, u8_t *b) {
+	return b >= a ? b - a : z.buf->size - (a - b);
+}
+
+struct bits {
+	u8_t *p, *end;
+	u64_t acc;
+	unsigned n;
+};
+
+// n <= 32, v has no bits set above n, fails once end is reached
+static inline bool put_bits(struct bits *b, u32_t v, unsigned n) {
+	b->acc = b->acc << n | v;
+	b->n += n;
+	while (b->n >= 8) {
+		if (b->p == b->end) {
+			return false;
+		}
+		b->n -= 8;
+		*b->p++ = (u8_t)(b->acc >> b->n);
+	}
+	return true;
+}
+
+static inline bool flush_bits(struct bits *b) {
+	return b->n ? put_bits(b, 0, 8 - b->n) : true;
+}
+
+// keeps at least 57 bits available, may read up to 8 bytes beyond the packed data so zmem has that much slack
+static inline void fill_bits(struct bits *b) {
+	while (b->n <= 56) {
+		b->acc = b->acc << 8 | *b->p++;
+		b->n += 8;
+	}
+}
+
+static inline u32_t get_bits(struct bits *b, unsigned n) {
+	b->n -= n;
+	return n ? (u32_t)(b->acc >> b->n) & (u32_t)((1ULL << n) - 1) : 0;
+}
+
+static bool put_rice(struct bits *b, u32_t u, unsigned k) {
+	u32_t q = u >> k;
+	if (q < Z_ESC) {
+		return put_bits(b, (1U << (q + 1)) - 2, q + 1) && put_bits(b, u & ((1U << k) - 1), k);
+	}
+	return put_bits(b, (1U << Z_ESC) - 1, Z_ESC) && put_bits(b, u, 32);
+}
+
+static inline u32_t get_rice(struct bits *b, unsigned k) {
+	u32_t w, q;
+	fill_bits(b);
+	w = (u32_t)(b->acc >> (b->n - 32));
+	if ((w >> (32 - Z_ESC)) == (1U << Z_ESC) - 1) {
+		get_bits(b, Z_ESC);
+		return get_bits(b, 32);
+	}
+	q = __builtin_clz(~w);
+	get_bits(b, q + 1);
+	return q << k | get_bits(b, k);
+}
+
+static s32_t samples[Z_BLOCK / 4]; // one channel of a block - decode thread
+
+// pack one channel of a block of n samples: predictor order, wasted low bits, then rice coded residuals by partition
+static bool pack_channel(struct bits *b, u8_t *in, unsigned n, u8_t width, unsigned ch) {
+	u32_t bits = 0;
+	s64_t sum[3] = { 0, 0, 0 }, max[3] = { 0, 0, 0 };
+	unsigned shift = 0, order = 0, i, j;
+
+	for (i = 0; i < n; ++i) {
+		samples[i] = width == 4 ? ((s16_t *)(void *)in)[i * 2 + ch] : ((s32_t *)(void *)in)[i * 2 + ch];
+		bits |= samples[i];
+	}
+	if (bits) {
+		shift = __builtin_ctz(bits);
+	}
+
+	// choose the fixed predictor giving the smallest residuals which are sure to fit in 32 bits
+	for (i = 0; i < n; ++i) {
+		s64_t x  = samples[i] >>= shift;
+		s64_t x1 = i > 0 ? samples[i - 1] : 0;
+		s64_t x2 = i > 1 ? samples[i - 2] : 0;
+		s64_t e[3] = { x, x - x1, x - 2 * x1 + x2 };
+		for (j = 0; j < 3; ++j) {
+			s64_t a = e[j] < 0 ? -e[j] : e[j];
+			sum[j] += a;
+			if (a > max[j]) max[j] = a;
+		}
+	}
+	for (j = 1; j < 3; ++j) {
+		if (max[j] < (1 << 30) && sum[j] < sum[order]) {
+			order = j;
+		}
+	}
+
+	if (!put_bits(b, order, 2) || !put_bits(b, shift, 5)) {
+		return false;
+	}
+
+	for (i = 0; i < n; i += Z_PART) {
+		u32_t u[Z_PART];
+		u64_t usum = 0;
+		unsigned k = 0;
+		for (j = 0; j < Z_PART; ++j) {
+			s32_t x  = samples[i + j];
+			s32_t x1 = i + j > 0 ? samples[i + j - 1] : 0;
+			s32_t x2 = i + j > 1 ? samples[i + j - 2] : 0;
+			// residuals of the chosen order fit, so wrapping arithmetic gives them exactly
+			s32_t e  = (s32_t)(order == 0 ? (u32_t)x : order == 1 ? (u32_t)x - x1 : (u32_t)x - 2 * (u32_t)x1 + x2);
+			u[j] = (u32_t)e << 1 ^ (u32_t)(e >> 31);
+			usum += u[j];
+		}
+		// parameter close to log2 of the mean
+		while (k < 30 && ((u64_t)Z_PART << (k + 1)) <= usum) {
+			k++;
+		}
+		if (!put_bits(b, k, 5)) {
+			return false;
+		}
+		for (j = 0; j < Z_PART; ++j) {
+			if (!put_rice(b, u[j], k)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void unpack_channel(struct bits *b, u8_t *out, unsigned n, u8_t width, unsigned ch) {
+	unsigned order, shift, i, j, k;
+	s32_t x1 = 0, x2 = 0;
+
+	fill_bits(b);
+	order = get_bits(b, 2);
+	shift = get_bits(b, 5);
+
+	for (i = 0; i < n; i += Z_PART) {
+		fill_bits(b);
+		k = get_bits(b, 5);
+		for (j = 0; j < Z_PART; ++j) {
+			u32_t u = get_rice(b, k);
+			s32_t e = (s32_t)(u >> 1) ^ -(s32_t)(u & 1);
+			s32_t x = (s32_t)(order == 0 ? (u32_t)e : order == 1 ? (u32_t)e + x1 : (u32_t)e + 2 * (u32_t)x1 - x2);
+			x2 = x1; x1 = x;
+			if (width == 4) {
+				((s16_t *)(void *)out)[(i + j) * 2 + ch] = (s16_t)((u32_t)x << shift);
+			} else {
+				((s32_t *)(void *)out)[(i + j) * 2 + ch] = (s32_t)((u32_t)x << shift);
+			}
+		}
+	}
+}
+
+// returns packed length, or 0 if the block does not pack into max bytes
+static size_t pack_block(u8_t *in, u8_t width, u8_t *out, size_t max) {
+	struct bits b = { out, out + max, 0, 0 };
+	unsigned n = Z_BLOCK / width;
+	if (pack_channel(&b, in, n, width, 0) && pack_channel(&b, in, n, width, 1) && flush_bits(&b)) {
+		return b.p - out;
+	}
+	return 0;
+}
+
+static void _unpack(unsigned k, bool consume) {
+	struct zblock *blk = &z.blocks[k];
+	struct bits b = { z.zmem + blk->zoff, NULL, 0, 0 };
+	u8_t *out = z.buf->buf + (size_t)k * Z_BLOCK;
+	unsigned n = Z_BLOCK / blk->width;
+	u64_t start = now_ns();
+
+	unpack_channel(&b, out, n, blk->width, 0);
+	unpack_channel(&b, out, n, blk->width, 1);
+
+	z.unpack_ns += now_ns() - start;
+	z.unpack_frames += n;
+	z.unpacks++;
+
+	// packed data is freed in order when played, not when discarded by a flush as newer blocks remain
+	if (consume) {
+		z.ztail = blk->zoff + blk->zlen;
+	}
+	z.zbytes -= blk->zlen;
+	z.npacked--;
+	blk->zlen = 0;
+}
+
+// called by output thread with mutex locked before reading or skipping outputbuf from readp up to p + bytes
+// unpacks blocks in order from readp so the fifo of packed data stays ordered, and one block beyond so unpacking
+// runs ahead of playback, p may be ahead of readp when crossfading
+void _zbuf_stage(u8_t *p, size_t bytes) {
+	u8_t *readp = outputbuf->readp;
+	size_t end, used;
+	ssize_t d;
+	unsigned k;
+
+	if (!z.npacked) {
+		return;
+	}
+
+	used = _buf_used(outputbuf);
+	end = min(dist(readp, p) + bytes + Z_BLOCK, used);
+	k = (readp - outputbuf->buf) / Z_BLOCK;
+
+	for (d = -(ssize_t)((readp - outputbuf->buf) % Z_BLOCK); d < (ssize_t)end; d += Z_BLOCK) {
+		if (z.blocks[k].zlen) {
+			_unpack(k, true);
+		}
+		k = (k + 1) % z.nblocks;
+	}
+}
+
+// called with mutex locked after outputbuf is flushed
+void _zbuf_flush(void) {
+	unsigned k;
+
+	if (!z.blocks) {
+		return;
+	}
+
+	for (k = 0; k < z.nblocks; ++k) {
+		z.blocks[k].zlen = 0;
+	}
+	z.npacked = 0;
+	z.zbytes = 0;
+	z.zhead = z.ztail = 0;
+	z.packk = z.dropk = 0;
+	z.gen++;
+
+	madvise(z.buf->buf, z.buf->size, MADV_DONTNEED);
+}
+
+// called with mutex locked before writep is moved back to from, discarding the audio after it
+void _zbuf_discard(u8_t *from) {
+	size_t len, d;
+	unsigned k;
+	bool first = true;
+
+	if (!z.npacked) {
+		return;
+	}
+
+	len = dist(from, outputbuf->writep);
+	k = (from - outputbuf->buf) / Z_BLOCK;
+
+	for (d = 0; d < len + (from - outputbuf->buf) % Z_BLOCK; d += Z_BLOCK) {
+		struct zblock *blk = &z.blocks[k];
+		if (blk->zlen) {
+			if (first) {
+				// packed data from here on is no longer needed
+				z.zhead = blk->zoff;
+				first = false;
+			}
+			if (d == 0 && (from - outputbuf->buf) % Z_BLOCK) {
+				// audio before from is retained
+				_unpack(k, false);
+			} else {
+				z.zbytes -= blk->zlen;
+				z.npacked--;
+				blk->zlen = 0;
+			}
+		}
+		k = (k + 1) % z.nblocks;
+	}
+
+	z.gen++;
+}
+
+// called by decode thread after writing to outputbuf from from, width is the frame width when writing started
+void zbuf_written(u8_t *from, u8_t width) {
+	u8_t *writep = outputbuf->writep;
+	size_t off, len, next;
+	unsigned k;
+
+	if (!z.blocks || from == writep) {
+		return;
+	}
+
+	if (width != output.next_frame_bytes) {
+		width = Z_MIXED;
+	}
+	IF_DSD(
+		if (output.next_fmt != PCM) {
+			width = Z_MIXED;
+		}
+	)
+
+	off = from - outputbuf->buf;
+	len = dist(from, writep);
+	k = off / Z_BLOCK;
+
+	// the first block continues earlier writes unless they start at its beginning, later blocks are written afresh
+	if (off % Z_BLOCK == 0) {
+		z.blocks[k].width = width;
+	} else if (z.blocks[k].width != width) {
+		z.blocks[k].width = Z_MIXED;
+	}
+	for (next = Z_BLOCK - off % Z_BLOCK; next < len; next += Z_BLOCK) {
+		k = (k + 1) % z.nblocks;
+		z.blocks[k].width = width;
+	}
+}
+
+// release pages of blocks played since the last call, unless the decoder has already started refilling them
+static void drop_consumed(void) {
+	u8_t *readp  = load_acquire(outputbuf->readp);
+	u8_t *writep = outputbuf->writep;
+	size_t free  = outputbuf->size - dist(readp, writep);
+	unsigned cur = (readp - outputbuf->buf) / Z_BLOCK;
+
+	while (z.dropk != cur) {
+		u8_t *start = outputbuf->buf + (size_t)z.dropk * Z_BLOCK;
+		if (dist(writep, start) + Z_BLOCK <= free) {
+			madvise(start, Z_BLOCK, MADV_DONTNEED);
+		}
+		z.dropk = (z.dropk + 1) % z.nblocks;
+	}
+}
+
+// pack the next block if it is written and far enough ahead of readp, false once there is nothing more to do for now
+static bool pack_next(void) {
+	struct zblock *blk;
+	u8_t *start;
+	size_t used, d, off, avail, zlen;
+	unsigned k, gen;
+	u8_t width;
+	u64_t t;
+
+	LOCK;
+
+	used  = _buf_used(outputbuf);
+	start = outputbuf->buf + (size_t)z.packk * Z_BLOCK;
+	d = dist(outputbuf->readp, start);
+
+	if (d > used || d < Z_AHEAD) {
+		// block already played or too close to readp, move to the first block far enough ahead
+		z.packk = ((outputbuf->readp - outputbuf->buf) + Z_AHEAD + Z_BLOCK - 1) / Z_BLOCK % z.nblocks;
+		start = outputbuf->buf + (size_t)z.packk * Z_BLOCK;
+		d = dist(outputbuf->readp, start);
+	}
+
+	// crossfade reads ahead of readp so blocks are not packed while it is enabled
+	if (d + Z_BLOCK > used || d < Z_AHEAD || output.fade_mode == FADE_CROSSFADE) {
+		UNLOCK;
+		return false;
+	}
+
+	k = z.packk;
+	blk = &z.blocks[k];
+
+	if (blk->zlen || blk->width == Z_MIXED) {
+		z.packk = (k + 1) % z.nblocks;
+		UNLOCK;
+		return true;
+	}
+
+	// find contiguous space after zhead, or from the start of zmem, behind the oldest packed block
+	if (!z.npacked) {
+		z.zhead = z.ztail = 0;
+	}
+	off = z.zhead;
+	if (z.npacked && z.zhead <= z.ztail) {
+		avail = z.ztail - z.zhead;
+	} else {
+		avail = z.zsize - z.zhead;
+		if (avail < Z_MAXPACK) {
+			off = 0;
+			avail = z.ztail;
+		}
+	}
+
+	if (avail < Z_MAXPACK) {
+		UNLOCK;
+		return false;
+	}
+
+	gen = z.gen;
+	width = blk->width;
+
+	UNLOCK;
+
+	// pack without the mutex, zmem from off is not in use and the block is only read by the output thread once it
+	// reaches readp, which is checked again before committing
+	t = now_ns();
+	zlen = pack_block(start, width, z.zmem + off, Z_MAXPACK);
+	t = now_ns() - t;
+
+	LOCK;
+
+	if (gen == z.gen) {
+		d = dist(outputbuf->readp, start);
+		if (zlen && d >= Z_AHEAD && d + Z_BLOCK <= _buf_used(outputbuf)) {
+			blk->zoff = off;
+			blk->zlen = zlen;
+			z.zhead = off + zlen;
+			z.zbytes += zlen;
+			z.npacked++;
+			madvise(start, Z_BLOCK, MADV_DONTNEED);
+			z.raw_bytes += Z_BLOCK;
+			z.packed_bytes += zlen;
+		}
+		z.pack_ns += t;
+		z.packs++;
+		z.packk = (k + 1) % z.nblocks;
+	}
+
+	UNLOCK;
+
+	return true;
+}
+
+// called by decode thread to pack decoded audio and release the memory of played audio
+void zbuf_pack(void) {
+	unsigned i;
+
+	if (!z.blocks) {
+		return;
+	}
+
+	drop_consumed();
+
+	for (i = 0; i < Z_PACKS && pack_next(); ++i);
+
+	if (z.unpacks - z.reported >= Z_STATS && z.packs && z.raw_bytes) {
+		unsigned rate = output.current_sample_rate ? output.current_sample_rate : 44100;
+		double audio_ns = (double)z.unpack_frames * 1000000000 / rate;
+		LOG_INFO("packed %u bytes of %u, ratio %.2f, pack %u us/block, unpack %u us/block, %.2f%% of realtime",
+				 (unsigned)z.zbytes, (unsigned)(z.npacked * Z_BLOCK), (double)z.raw_bytes / z.packed_bytes,
+				 (unsigned)(z.pack_ns / z.packs / 1000), (unsigned)(z.unpack_ns / z.unpacks / 1000),
+				 100.0 * z.unpack_ns / audio_ns);
+		z.reported = z.unpacks;
+	}
+}
+
+// decode space allowing for memory use, packed blocks plus unpacked audio are kept within that requested
+unsigned zbuf_space(unsigned space) {
+	size_t used, raw, resident;
+
+	if (!z.blocks) {
+		return space;
+	}
+
+	used = _buf_used(outputbuf);
+	raw = used - min(used, (size_t)z.npacked * Z_BLOCK);
+	resident = raw + z.zbytes;
+
+	return resident < z.budget ? min(space, z.budget - resident) : 0;
+}
+
+// allocate buf as the address space for a compressed outputbuf using size bytes of memory
+// returns false leaving buf unallocated if this is not possible
+bool zbuf_init(log_level level, struct buffer *buf, size_t size) {
+	loglevel = level;
+
+	size = max(size, 2 * Z_RAW);
+
+	buf_init_paged(buf, (size * Z_RATIO + Z_BLOCK - 1) / Z_BLOCK * Z_BLOCK);
+	if (!buf->buf) {
+		return false;
+	}
+	if (!(buf->mem & BUF_PAGED) || buf->size % Z_BLOCK) {
+		LOG_WARN("unable to map compressed outputbuf");
+		buf_destroy(buf);
+		return false;
+	}
+
+	z.buf = buf;
+	z.nblocks = buf->size / Z_BLOCK;
+	z.blocks = calloc(z.nblocks, sizeof(struct zblock));
+	z.budget = size;
+	z.zsize = size - Z_RAW + 8;
+	z.zmem = buf_mem_alloc(&z.zsize, &z.zmem_mem);
+	if (!z.blocks || !z.zmem) {
+		LOG_WARN("unable to allocate compressed outputbuf");
+		zbuf_close();
+		buf_destroy(buf);
+		return false;
+	}
+	// slack for reading ahead when unpacking
+	z.zsize -= 8;
+
+	LOG_INFO("compressed outputbuf: %u blocks of %u bytes, packed blocks: %u bytes at %p" BUF_MEM_FMT,
+			 z.nblocks, Z_BLOCK, (unsigned)z.zsize, z.zmem, BUF_MEM_ARGS(z.zmem_mem));
+
+	return true;
+}
+
+void zbuf_close(void) {
+	if (z.zmem) {
+		buf_mem_free(z.zmem, z.zsize + 8, z.zmem_mem);
+	}
+	free(z.blocks);
+	memset(&z, 0, sizeof(z));
+}
+
+#endif
@@ -45,17 +45,9 @@ bool pcm_check_header = false;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct   if (!decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_not_direct if (!decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct
-#define UNLOCK_O_not_direct
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -180,6 +172,33 @@ static void _check_header(void) {
 	}
 }
 
+// write 8 or 16 bit mono or stereo samples as narrow 16 bit stereo frames
+static void _narrow_frames(s16_t *optr, u8_t *iptr, frames_t frames) {
+	frames_t count = frames * channels;
+
+	if (channels == 2 && sample_size == 2 && bigendian == !SL_LITTLE_ENDIAN) {
+		// native endian 16 bit stereo is already in narrow frame layout
+		memcpy(optr, iptr, frames * NARROW_BYTES_PER_FRAME);
+		return;
+	}
+
+	while (count--) {
+		s16_t sample;
+		if (sample_size == 1) {
+			sample = *iptr << 8;
+		} else if (bigendian) {
+			sample = *(iptr) << 8 | *(iptr+1);
+		} else {
+			sample = *(iptr) | *(iptr+1) << 8;
+		}
+		iptr += sample_size;
+		*optr++ = sample;
+		if (channels == 1) {
+			*optr++ = sample;
+		}
+	}
+}
+
 static decode_state pcm_decode(void) {
 	unsigned bytes, in, out;
 	frames_t frames, count;
@@ -193,28 +212,27 @@ static decode_state pcm_decode(void) {
 		_check_header();
 	}
 
-	LOCK_O_direct;
-
 	bytes = min(_buf_used(streambuf), _buf_cont_read(streambuf));
 
 	IF_DIRECT(
-		out = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
+		out = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / output.next_frame_bytes;
 	);
 	IF_PROCESS(
 		out = process.max_in_frames;
 	);
 
 	if ((stream.state <= DISCONNECT && bytes < bytes_per_frame) || (limit && audio_left == 0)) {
-		UNLOCK_O_direct;
 		UNLOCK_S;
 		return DECODE_COMPLETE;
 	}
 
 	if (decode.new_stream) {
 		LOG_INFO("setting track_start");
-		LOCK_O_not_direct;
-		output.track_start = outputbuf->writep;
+		LOCK_O;
+		_output_track_start(outputbuf->writep);
 		decode.new_stream = false;
+		// any header has been read so the stream's parameters are known
+		stream_bitrate(sample_rate * sample_size * 8 * channels / 1000);
 #if DSD
 		if (sample_size == 3 &&
 			is_stream_dop(((u8_t *)streambuf->readp) + (bigendian?0:2),
@@ -226,17 +244,23 @@ static decode_state pcm_decode(void) {
 			else
 				output.next_fmt = DOP;
 			output.next_sample_rate = sample_rate;
+			output.next_frame_bytes = BYTES_PER_FRAME;
 			output.fade = FADE_INACTIVE;
 		} else {
 			output.next_sample_rate = decode_newstream(sample_rate, output.supported_rates);
 			output.next_fmt = PCM;
+			decode_frame_bytes(sample_size * 8);
 			if (output.fade_mode) _checkfade(true);
 		}
 #else
 		output.next_sample_rate = decode_newstream(sample_rate, output.supported_rates);
+		decode_frame_bytes(sample_size * 8);
 		if (output.fade_mode) _checkfade(true);
 #endif
-		UNLOCK_O_not_direct;
+		UNLOCK_O;
+		IF_DIRECT(
+			out = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / output.next_frame_bytes;
+		);
 		IF_PROCESS(
 			out = process.max_in_frames;
 		);
@@ -272,7 +296,10 @@ static decode_state pcm_decode(void) {
 
 	count = frames * channels;
 
-	if (channels == 2) {
+	if (output.next_frame_bytes != BYTES_PER_FRAME && channels <= 2) {
+		// narrow 16 bit frames, only selected for sources of 16 bits or less
+		_narrow_frames((s16_t *)optr, iptr, frames);
+	} else if (channels == 2) {
 		if (sample_size == 1) {
 			while (count--) {
 				*optr++ = *iptr++ << (24-SHIFT);
@@ -425,13 +452,12 @@ static decode_state pcm_decode(void) {
 	}
 
 	IF_DIRECT(
-		_buf_inc_writep(outputbuf, frames * BYTES_PER_FRAME);
+		_buf_inc_writep(outputbuf, frames * output.next_frame_bytes);
 	);
 	IF_PROCESS(
 		process.in_frames = frames;
 	);
 
-	UNLOCK_O_direct;
 	UNLOCK_S;
 
 	return DECODE_RUNNING;
@@ -446,6 +472,12 @@ static void pcm_open(u8_t size, u8_t rate, u8_t chan, u8_t endianness) {
 
 	LOG_INFO("pcm size: %u rate: %u chan: %u bigendian: %u", sample_size, sample_rate, channels, bigendian);
 	buf_adjust(streambuf, sample_size * channels);
+
+	// size streambuf for the stream's own bitrate when given, else from the header in pcm_decode
+	if (size >= '0' && size <= '3' && rate >= '0' && rate - '0' < sizeof(sample_rates) / sizeof(u32_t) &&
+		(chan == '1' || chan == '2')) {
+		stream_bitrate(sample_rate * sample_size * 8 * channels / 1000);
+	}
 }
 
 static void pcm_close(void) {
@@ -463,6 +495,7 @@ struct codec *register_pcm(void) {
 			pcm_open,    // open
 			pcm_close,   // close
 			pcm_decode,  // decode
+			1411,        // bitrate kbps
 		};
 
 		LOG_INFO("using pcm to decode wav,aif,pcm");
@@ -478,6 +511,7 @@ struct codec *register_pcm(void) {
 			pcm_open,    // open
 			pcm_close,   // close
 			pcm_decode,  // decode
+			1411,        // bitrate kbps
 		};
 
 		LOG_INFO("using pcm to decode aif,pcm");
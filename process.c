@@ -34,8 +34,6 @@ extern struct codec *codec;
 
 #define LOCK_D   mutex_lock(decode.mutex);
 #define UNLOCK_D mutex_unlock(decode.mutex);
-#define LOCK_O   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O mutex_unlock(outputbuf->mutex)
 
 // macros to map to processing functions - currently only resample.c
 // this can be made more generic when multiple processing mechanisms get added
@@ -54,8 +52,7 @@ static void _write_samples(void) {
 	u32_t *iptr   = (u32_t *)process.outbuf;
 	unsigned cnt  = 10;
 
-	LOCK_O;
-
+	// outputbuf is written lock free as the decode thread is its only producer
 	while (frames > 0) {
 
 		frames_t f = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
@@ -75,20 +72,15 @@ static void _write_samples(void) {
 		} else if (cnt--) {
 
 			// there should normally be space in the output buffer, but may need to wait during drain phase
-			UNLOCK_O;
 			usleep(10000);
-			LOCK_O;
 
 		} else {
 
 			// bail out if no space found after 100ms to avoid locking
 			LOG_ERROR("unable to get space in output buffer");
-			UNLOCK_O;
 			return;
 		}
 	}
-
-	UNLOCK_O;
 }
 
 // process samples - called with decode mutex set
@@ -117,9 +109,9 @@ void process_drain(void) {
 }	
 
 // new stream - called with decode mutex set
-unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[]) {
+unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[], unsigned cross_rate) {
 
-	bool active = NEWSTREAM_FUNC(&process, raw_sample_rate, supported_rates);
+	bool active = NEWSTREAM_FUNC(&process, raw_sample_rate, supported_rates, cross_rate);
 
 	LOG_INFO("processing: %s", active ? "active" : "inactive");
 
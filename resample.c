@@ -42,6 +42,7 @@ struct soxr {
 	double scale;
 	bool max_rate;
 	bool exception;
+	bool cross;                 // the last stream was resampled to the previous rate for a crossfade
 #if !LINKALL
 	// soxr symbols to be dynamically loaded
 	soxr_io_spec_t (* soxr_io_spec)(soxr_datatype_t itype, soxr_datatype_t otype);
@@ -129,7 +130,7 @@ bool resample_drain(struct processstate *process) {
 	}
 }
 
-bool resample_newstream(struct processstate *process, unsigned raw_sample_rate, unsigned supported_rates[]) {
+bool resample_newstream(struct processstate *process, unsigned raw_sample_rate, unsigned supported_rates[], unsigned cross_rate) {
 	unsigned outrate = 0;
 	int i;
 
@@ -169,6 +170,16 @@ bool resample_newstream(struct processstate *process, unsigned raw_sample_rate,
 		}
 	}
 
+	if (cross_rate && cross_rate != outrate && !r->cross) {
+		// crossfade from the previous track at its rate, which is already one the device supports, only for a track
+		// which followed one at its own rate so a run of tracks returns to the rate chosen for them after one fade
+		LOG_INFO("crossfade at %u rather than %u", cross_rate, outrate);
+		outrate = cross_rate;
+		r->cross = true;
+	} else {
+		r->cross = false;
+	}
+
 	process->in_sample_rate = raw_sample_rate;
 	process->out_sample_rate = outrate;
 
@@ -287,6 +298,7 @@ bool resample_init(char *opt) {
 	r->old_clips = 0;
 	r->max_rate = false;
 	r->exception = false;
+	r->cross = false;
 
 	if (!load_soxr()) {
 		LOG_WARN("resampling disabled");
@@ -80,11 +80,19 @@ static struct {
 	u32_t frames_played;
 	u32_t device_frames;
 	u32_t current_sample_rate;
+	u32_t history_ms;
+	s32_t start_error_us;
+	bool start_measured;
 	u32_t last;
 	stream_state stream_state;
 } status;
 
 int autostart;
+
+// release buffer memory after this many ms stopped or off with no stream, 0 to keep it, set from command line
+u32_t idle_release = 0;
+static bool released = false;
+static u32_t reacquired_ms = 0; // strm 's' which faulted released buffers back in, timed to the first frame written
 bool sentSTMu, sentSTMo, sentSTMl;
 u32_t new_server;
 char *new_server_cap;
@@ -159,6 +167,10 @@ static void sendSTAT(const char *event, u32_t server_timestamp) {
 	struct STAT_packet pkt;
 	u32_t now = gettime_ms();
 	u32_t ms_played;
+	// only extend the packet when history is retained or a timed start measured so servers which check its length
+	// are unaffected
+	size_t len = sizeof(pkt) - (status.start_measured ? 0 : sizeof(pkt.start_error_us));
+	if (!status.start_measured && !output.history_size) len -= sizeof(pkt.history_ms);
 
 	if (status.current_sample_rate && status.frames_played && status.frames_played > status.device_frames) {
 		ms_played = (u32_t)(((u64_t)(status.frames_played - status.device_frames) * (u64_t)1000) / (u64_t)status.current_sample_rate);
@@ -174,7 +186,7 @@ static void sendSTAT(const char *event, u32_t server_timestamp) {
 	
 	memset(&pkt, 0, sizeof(struct STAT_packet));
 	memcpy(&pkt.opcode, "STAT", 4);
-	pkt.length = htonl(sizeof(struct STAT_packet) - 8);
+	pkt.length = htonl(len - 8);
 	memcpy(&pkt.event, event, 4);
 	// num_crlf
 	// mas_initialized; mas_mode;
@@ -191,6 +203,8 @@ static void sendSTAT(const char *event, u32_t server_timestamp) {
 	packN(&pkt.elapsed_milliseconds, ms_played);
 	pkt.server_timestamp = server_timestamp; // keep this is server format - don't unpack/pack
 	// error_code;
+	packN(&pkt.history_ms, status.history_ms);
+	packN(&pkt.start_error_us, (u32_t)status.start_error_us);
 
 	LOG_DEBUG("STAT: %s", event);
 
@@ -200,7 +214,7 @@ static void sendSTAT(const char *event, u32_t server_timestamp) {
 				   ms_played - now + status.stream_start, status.device_frames * 1000 / status.current_sample_rate, now - status.updated);
 	}
 
-	send_packet((u8_t *)&pkt, sizeof(pkt));
+	send_packet((u8_t *)&pkt, len);
 }
 
 static void sendDSCO(disconnect_code disconnect) {
@@ -291,6 +305,7 @@ static void process_strm(u8_t *pkt, int len) {
 		stream_disconnect();
 		sendSTAT("STMf", 0);
 		buf_flush(streambuf);
+		reacquired_ms = 0;
 		break;
 	case 'f': 
 		{
@@ -315,6 +330,7 @@ static void process_strm(u8_t *pkt, int len) {
 				output.stop_time = gettime_ms();
 			}
 			UNLOCK_O;
+			wake_output();
 			if (!interval) sendSTAT("STMp", 0);
 			LOG_DEBUG("pause interval: %u", interval);
 		}
@@ -322,10 +338,28 @@ static void process_strm(u8_t *pkt, int len) {
 	case 'a':
 		{
 			unsigned interval = unpackN(&strm->replay_gain);
+			if ((s32_t)interval < 0) {
+				// negative skip, served from playback history if retained
+				frames_t frames = (u64_t)-(s32_t)interval * status.current_sample_rate / 1000;
+				bool ok;
+				LOCK_D;
+				LOCK_O;
+				ok = _output_rewind(frames);
+				if (ok) {
+					// audio already queued in the device is from beyond the new position
+					output.tail_drop = true;
+				}
+				UNLOCK_O;
+				UNLOCK_D;
+				wake_output();
+				LOG_DEBUG("skip back interval: %u %s", -(s32_t)interval, ok ? "from history" : "beyond history, ignored");
+				break;
+			}
 			LOCK_O;
 			output.skip_frames = interval * status.current_sample_rate / 1000;
 			output.state = OUTPUT_SKIP_FRAMES;				
 			UNLOCK_O;
+			wake_output();
 			LOG_DEBUG("skip ahead interval: %u", interval);
 		}
 		break;
@@ -336,6 +370,7 @@ static void process_strm(u8_t *pkt, int len) {
 			output.state = jiffies ? OUTPUT_START_AT : OUTPUT_RUNNING;
 			output.start_at = jiffies;
 			UNLOCK_O;
+			wake_output();
 
 			LOG_DEBUG("unpause at: %u now: %u", jiffies, gettime_ms());
 			sendSTAT("STMr", 0);
@@ -354,6 +389,15 @@ static void process_strm(u8_t *pkt, int len) {
 			
 			autostart = strm->autostart - '0';
 
+			if (released) {
+				// buffers are faulted back in before the stream starts, adding to the time to first audio logged once
+				// the track's first frame is written
+				reacquired_ms = gettime_ms();
+				stream_reacquire();
+				output_reacquire();
+				released = false;
+			}
+
 			sendSTAT("STMf", 0);
 			if (header_len > MAX_HEADER -1) {
 				LOG_WARN("header too long: %u", header_len);
@@ -435,6 +479,7 @@ static void process_aude(u8_t *pkt, int len) {
 		output.stop_time = gettime_ms();
 	}
 	UNLOCK_O;
+	wake_output();
 }
 
 static void process_audg(u8_t *pkt, int len) {
@@ -629,6 +674,8 @@ static void slimproto_run() {
 			bool _sendSTMn = false;
 			bool _stream_disconnect = false;
 			bool _start_output = false;
+			bool _release = false;
+			bool _wake_output = false;
 			decode_state _decode_state;
 			disconnect_code disconnect_code;
 			static char header[MAX_HEADER];
@@ -698,11 +745,20 @@ static void slimproto_run() {
 			status.current_sample_rate = output.current_sample_rate;
 			status.updated = output.updated;
 			status.device_frames = output.device_frames;
+			status.history_ms = output.current_sample_rate ?
+				(u32_t)((u64_t)_output_history() * 1000 / output.current_sample_rate) : 0;
+			status.start_error_us = output.start_error_us;
+			status.start_measured = output.start_measured;
 			
 			if (output.track_started) {
 				_sendSTMs = true;
 				output.track_started = false;
 				status.stream_start = output.track_start_time;
+				if (reacquired_ms) {
+					LOG_INFO("time to first audio after releasing idle buffer memory: %u ms",
+							 output.track_start_time - reacquired_ms);
+					reacquired_ms = 0;
+				}
 			}
 #if PORTAUDIO
 			if (output.pa_reopen) {
@@ -712,6 +768,7 @@ static void slimproto_run() {
 #endif
 			if (_start_output && (output.state == OUTPUT_STOPPED || output.state == OUTPUT_OFF)) {
 				output.state = OUTPUT_BUFFER;
+				_wake_output = true;
 			}
 			if (output.state == OUTPUT_RUNNING && !sentSTMu && status.output_full == 0 && status.stream_state <= DISCONNECT &&
 				_decode_state == DECODE_STOPPED) {
@@ -731,6 +788,10 @@ static void slimproto_run() {
 				output.state = OUTPUT_OFF;
 				LOG_DEBUG("output timeout");
 			}
+			if (idle_release && output.state <= OUTPUT_STOPPED && status.stream_state <= DISCONNECT &&
+				_decode_state != DECODE_RUNNING && now - output.stop_time > idle_release) {
+				_release = true;
+			}
 			if (output.state == OUTPUT_RUNNING && now - status.last > 1000) {
 				_sendSTMt = true;
 				status.last = now;
@@ -749,6 +810,16 @@ static void slimproto_run() {
 #endif
 
 			if (_stream_disconnect) stream_disconnect();
+			if (_wake_output) wake_output();
+
+			if (_release) {
+				// retried while idle as outputbuf is only released once empty, already released buffers are skipped
+				size_t bytes = stream_release() + output_release();
+				if (bytes) {
+					released = true;
+					LOG_INFO("idle - released %u bytes of buffer memory", (unsigned)bytes);
+				}
+			}
 
 			// send packets once locks released as packet sending can block
 			if (_sendDSCO) sendDSCO(disconnect_code);
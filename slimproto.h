@@ -62,6 +62,9 @@ struct STAT_packet {
 	u32_t elapsed_milliseconds;
 	u32_t server_timestamp;
 	u16_t error_code;
+	u32_t history_ms;          // squeezelite extension - playback history retained for negative skips, sent if enabled
+	u32_t start_error_us;      // squeezelite extension - signed us the last timed start was heard after its jiffies, sent
+	                           // once one has been made
 };
 
 // S:N:Slimproto _disco_handler
@@ -264,10 +264,13 @@
 // config options
 #define STREAMBUF_SIZE (2 * 1024 * 1024)
 #define OUTPUTBUF_SIZE (44100 * 8 * 10)
-#define OUTPUTBUF_SIZE_CROSSFADE (OUTPUTBUF_SIZE * 12 / 10)
+#define STREAMBUF_SIZE_MIN (256 * 1024)  // lower bounds when buffers are sized in seconds
+#define OUTPUTBUF_SIZE_MIN (512 * 1024)
 
 #define MAX_HEADER 4096 // do not reduce as icy-meta max is 4080
 
+#define CACHELINE_SIZE 64
+
 #if ALSA
 #define ALSA_BUFFER_TIME  40
 #define ALSA_PERIOD_COUNT 4
@@ -338,9 +341,14 @@ typedef int64_t   s64_t;
 #define mutex_create_p(m) pthread_mutexattr_t attr; pthread_mutexattr_init(&attr); pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT); pthread_mutex_init(&m, &attr); pthread_mutexattr_destroy(&attr)
 #define mutex_lock(m) pthread_mutex_lock(&m)
 #define mutex_unlock(m) pthread_mutex_unlock(&m)
+#define mutex_trylock(m) (pthread_mutex_trylock(&m) == 0)
 #define mutex_destroy(m) pthread_mutex_destroy(&m)
 #define thread_type pthread_t
 
+#define CACHELINE_ALIGN __attribute__((aligned(CACHELINE_SIZE)))
+#define load_acquire(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
 #endif
 
 #if WIN
@@ -372,9 +380,15 @@ typedef BOOL bool;
 #define mutex_create_p mutex_create
 #define mutex_lock(m) WaitForSingleObject(m, INFINITE)
 #define mutex_unlock(m) ReleaseMutex(m)
+#define mutex_trylock(m) (WaitForSingleObject(m, 0) == WAIT_OBJECT_0)
 #define mutex_destroy(m) CloseHandle(m)
 #define thread_type HANDLE
 
+// msvc treats volatile accesses as acquire/release on x86 and x64
+#define CACHELINE_ALIGN __declspec(align(CACHELINE_SIZE))
+#define load_acquire(p) (*(volatile void **)&(p))
+#define store_release(p, v) (*(volatile void **)&(p) = (v))
+
 #define usleep(x) Sleep(x/1000)
 #define sleep(x) Sleep(x*1000)
 #define last_error() WSAGetLastError()
@@ -447,15 +461,29 @@ struct wake {
 
 #define FIXED_ONE 0x10000
 
+// FLOAT_LE output: a Q16 gain times this scales samples to +-1.0, gain being applied in float without clamping
+#define FLOAT_GAIN_SCALE (1.0F / 140737488355328.0F)
+
 #define BYTES_PER_FRAME 8
 
+// 16 bit sources may be stored in outputbuf as 16 bit stereo frames when BYTES_PER_FRAME is 8 and the output supports it
+#define NARROW_BYTES_PER_FRAME 4
+
 #if BYTES_PER_FRAME == 8
 #define ISAMPLE_T 		s32_t
 #else
 #define ISAMPLE_T		s16_t
 #endif
 
+// vector pack kernels in output_pack_simd.c, selected at runtime by cpu features
+#if BYTES_PER_FRAME == 8 && SL_LITTLE_ENDIAN && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define PACK_SIMD 1
+#else
+#define PACK_SIMD 0
+#endif
+
 #define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
 
 // logging
 typedef enum { lERROR = 0, lWARN, lINFO, lDEBUG, lSDEBUG } log_level;
@@ -477,6 +505,7 @@ char* strcasestr(const char *haystack, const char *needle);
 
 char *next_param(char *src, char c);
 u32_t gettime_ms(void);
+u64_t gettime_us(void);
 void get_mac(u8_t *mac);
 void set_nonblock(sockfd s);
 void set_recvbufsize(sockfd s);
@@ -509,31 +538,67 @@ int poll(struct pollfd *fds, unsigned long numfds, int timeout);
 #if LINUX || FREEBSD
 void touch_memory(u8_t *buf, size_t size);
 #endif
+#if LINUX && !SUN
+bool lock_thread_stack(void **addr, size_t *size);
+#endif
 
 // buffer.c
+// single producer / single consumer ring: writep is only advanced by the producer and readp by the consumer,
+// each published with release semantics on its own cache line so neither side needs the mutex to move data
+// the mutex is retained for control operations (flush, adjust, resize, unwrap) and for state protected alongside the buffer
 struct buffer {
 	u8_t *buf;
-	u8_t *readp;
-	u8_t *writep;
 	u8_t *wrap;
 	size_t size;
 	size_t base_size;
+	u8_t mem;     // BUF_* flags describing how buf was allocated
+	int fd;       // BUF_FILE: backing file
+	u8_t *dropp;  // BUF_FILE: start of region consumed but not yet released from the page cache
+	const char *dir; // directory for backing file, NULL for memory
+	bool paged;   // pages not locked or prefaulted so the owner can release them
 	mutex_type mutex;
+	CACHELINE_ALIGN u8_t *writep;
+	CACHELINE_ALIGN u8_t *readp;
 };
 
-// _* called with mutex locked
+#define BUF_MIRROR 0x01 // mapped twice back to back, reads and writes never need splitting at wrap
+#define BUF_MMAP   0x02 // anonymous or memfd mapping rather than malloc
+#define BUF_HUGE   0x04 // explicit huge pages
+#define BUF_THP    0x08 // transparent huge pages advised
+#define BUF_LOCKED 0x10 // locked in memory
+#define BUF_FILE   0x20 // memory mapped file on local storage
+#define BUF_PAGED  0x40 // anonymous mapping of normal pages which are released when not needed
+#define BUF_RELEASED 0x80 // pages returned to the system while idle, faulted back in by buf_mem_reacquire
+
+// log how a buffer was allocated: LOG_INFO("name: %u bytes at %p" BUF_MEM_FMT, size, p, BUF_MEM_ARGS(mem))
+#define BUF_MEM_FMT "%s%s%s%s%s%s"
+#define BUF_MEM_ARGS(mem) ((mem) & BUF_MIRROR ? " mirrored" : ""), ((mem) & BUF_FILE ? " file backed" : ""), \
+	((mem) & BUF_PAGED ? " paged" : ""), \
+	((mem) & BUF_HUGE ? " huge pages" : ""), ((mem) & BUF_THP ? " transparent huge pages" : ""), \
+	((mem) & BUF_LOCKED ? " locked" : " not locked")
+
+// _* called with mutex locked, or without it by the single producer / consumer for the index functions
 unsigned _buf_used(struct buffer *buf);
 unsigned _buf_space(struct buffer *buf);
 unsigned _buf_cont_read(struct buffer *buf);
 unsigned _buf_cont_write(struct buffer *buf);
 void _buf_inc_readp(struct buffer *buf, unsigned by);
+void _buf_dec_readp(struct buffer *buf, unsigned by);
 void _buf_inc_writep(struct buffer *buf, unsigned by);
 void buf_flush(struct buffer *buf);
 void _buf_unwrap(struct buffer *buf, size_t cont);
 void buf_adjust(struct buffer *buf, size_t mod);
-void _buf_resize(struct buffer *buf, size_t size);
+bool _buf_resize(struct buffer *buf, size_t size);
+size_t _buf_release(struct buffer *buf);
+void _buf_reacquire(struct buffer *buf);
 void buf_init(struct buffer *buf, size_t size);
+void buf_init_file(struct buffer *buf, size_t size, const char *dir);
+void buf_init_paged(struct buffer *buf, size_t size);
 void buf_destroy(struct buffer *buf);
+u8_t *buf_mem_alloc(size_t *size, u8_t *mem);
+void buf_mem_free(u8_t *p, size_t size, u8_t mem);
+size_t buf_mem_release(u8_t *p, size_t size, u8_t *mem);
+void buf_mem_reacquire(u8_t *p, size_t size, u8_t *mem);
 
 // slimproto.c
 void slimproto(log_level level, char *server, u8_t mac[6], const char *name, const char *namefile, const char *modelname, int maxSampleRate);
@@ -563,8 +628,11 @@ struct streamstate {
 void stream_init(log_level level, unsigned stream_buf_size);
 void stream_close(void);
 void stream_file(const char *header, size_t header_len, unsigned threshold);
+void stream_bitrate(unsigned kbps);
 void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *header, size_t header_len, unsigned threshold, bool cont_wait);
 bool stream_disconnect(void);
+size_t stream_release(void);
+void stream_reacquire(void);
 
 // decode.c
 typedef enum { DECODE_STOPPED = 0, DECODE_READY, DECODE_RUNNING, DECODE_COMPLETE, DECODE_ERROR } decode_state;
@@ -597,12 +665,14 @@ struct codec {
 	void (*open)(u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness);
 	void (*close)(void);
 	decode_state (*decode)(void);
+	unsigned bitrate; // nominal kbps, used to size streambuf when specified in seconds
 };
 
 void decode_init(log_level level, const char *include_codecs, const char *exclude_codecs);
 void decode_close(void);
 void decode_flush(void);
 unsigned decode_newstream(unsigned sample_rate, unsigned supported_rates[]);
+u8_t decode_frame_bytes(unsigned sample_bits);
 void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness);
 
 #if PROCESS
@@ -610,7 +680,7 @@ void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels,
 void process_samples(void);
 void process_drain(void);
 void process_flush(void);
-unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[]);
+unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[], unsigned cross_rate);
 void process_init(char *opt);
 #endif
 
@@ -618,7 +688,7 @@ void process_init(char *opt);
 // resample.c
 void resample_samples(struct processstate *process);
 bool resample_drain(struct processstate *process);
-bool resample_newstream(struct processstate *process, unsigned raw_sample_rate, unsigned supported_rates[]);
+bool resample_newstream(struct processstate *process, unsigned raw_sample_rate, unsigned supported_rates[], unsigned cross_rate);
 void resample_flush(void);
 bool resample_init(char *opt);
 #endif
@@ -629,23 +699,76 @@ typedef enum { OUTPUT_OFF = -1, OUTPUT_STOPPED = 0, OUTPUT_BUFFER, OUTPUT_RUNNIN
 
 #if DSD
 typedef enum { PCM, DOP, DSD_U8, DSD_U16_LE, DSD_U32_LE, DSD_U16_BE, DSD_U32_BE, DOP_S24_LE, DOP_S24_3LE } dsd_format;
-typedef enum { S32_LE, S24_LE, S24_3LE, S16_LE, U8, U16_LE, U16_BE, U32_LE, U32_BE } output_format;
+typedef enum { S32_LE, S24_LE, S24_3LE, S16_LE, FLOAT_LE, U8, U16_LE, U16_BE, U32_LE, U32_BE } output_format;
 #else
-typedef enum { S32_LE, S24_LE, S24_3LE, S16_LE } output_format;
+typedef enum { S32_LE, S24_LE, S24_3LE, S16_LE, FLOAT_LE } output_format;
 #endif
 
-typedef enum { FADE_INACTIVE = 0, FADE_DUE, FADE_ACTIVE } fade_state;
+typedef enum { DITHER_NONE = 0, DITHER_TPDF, DITHER_SHAPED1, DITHER_SHAPED2, DITHER_LIPSHITZ } dither_type;
+
+typedef enum { FADE_INACTIVE = 0, FADE_ACTIVE, FADE_DROPPED } fade_state;
 typedef enum { FADE_UP = 1, FADE_DOWN, FADE_CROSS } fade_dir;
 typedef enum { FADE_NONE = 0, FADE_CROSSFADE, FADE_IN, FADE_OUT, FADE_INOUT } fade_mode;
+typedef enum { FADE_LINEAR = 0, FADE_POWER, FADE_LOG } fade_curve;
+
+#define OUTPUT_MARKERS 16          // queued track starts and fades, each decoded track uses at most two
+
+// position in outputbuf where a track starts and/or a fade begins, queued in outputbuf order by the decode thread
+struct marker {
+	u8_t *pos;
+	bool  track;                   // track starts at pos
+	bool  sealed;                  // track parameters below are final, until then those of outputstate are used
+	unsigned sample_rate;
+	u32_t replay_gain;
+	u8_t  frame_bytes;
+#if DSD
+	dsd_format fmt;
+#endif
+	fade_dir fade_dir;             // 0 if no fade begins at pos
+	fade_mode fade_mode;
+	u8_t *fade_end;
+};
 
 #define MONO_RIGHT	0x02
 #define MONO_LEFT	0x01
+#if DSD
+#define DSD_DOP		0x04	// _scale_and_pack_fused: update dop markers
+#define DSD_INVERT	0x08	// _scale_and_pack_fused: invert dsd data, within the dop payload if DSD_DOP
+#endif
+
+// pack function specialised for an output format, mono and dsd flags and gain class, see _pack_select
+struct pack_spec {
+	void (* pack)(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR);
+	output_format format;
+	u8_t flags;
+	bool unity;
+	dither_type dither;            // requantisation of S16_LE and S24 formats when gain is applied
+	u8_t bytes;                    // packed bytes per frame
+	const char *name;              // format name for logging
+};
+
+// gains ramped per frame across a chunk of output, frame i having gain ((gain << RAMP_SHIFT) + step * i) >> RAMP_SHIFT
+#define RAMP_SHIFT 8
+struct gain_ramp {
+	s32_t stepL, stepR;            // volume and fade, of gainL and gainR
+	s32_t step_in, step_out;       // crossfade, of the cross_mix gains
+};
+
+// crossfade mix of the track fading out, read from readp, with the track fading in, read from ptr - each read from
+// outputbuf at its own frame width
+struct cross_mix {
+	s32_t gain_in, gain_out;       // Q16 gains of the tracks fading in and out
+	u8_t *ptr;                     // next frame of the track fading in, advanced as it is mixed
+	u8_t  in_bytes, out_bytes;     // bytes per frame of the tracks fading in and out
+};
+
 #define MAX_SUPPORTED_SAMPLERATES 20
 #define TEST_RATES = { 1536000, 1411200, 768000, 705600, 384000, 352800, 192000, 176400, 96000, 88200, 48000, 44100, 32000, 24000, 22500, 16000, 12000, 11025, 8000, 0 }
 
 struct outputstate {
 	output_state state;
 	output_format format;
+	struct pack_spec pack;
 	u8_t channels;
 	const char *device;
 #if ALSA
@@ -658,7 +781,9 @@ struct outputstate {
 	unsigned latency;
 	int pa_hostapi_option;
 #endif
-	int (* write_cb)(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags, s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr);
+	int (* write_cb)(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags, struct cross_mix *cross,
+					 const struct gain_ramp *ramp);
+	void (* wake_cb)(void);    // set by outputs which sleep on an event rather than polling, called by wake_output
 	unsigned start_frames;
 	unsigned frames_played;
 	unsigned frames_played_dmp;// frames played at the point delay is measured
@@ -668,6 +793,9 @@ struct outputstate {
 	bool error_opening;
 	unsigned device_frames;
 	u32_t updated;
+	u64_t updated_us;          // gettime_us time device_frames was measured if the output timestamps it, else 0
+	s32_t start_error_us;      // when the first frame of the last OUTPUT_START_AT was heard relative to start_at
+	bool  start_measured;      // start_error_us is set
 	u32_t track_start_time;
 	u32_t current_replay_gain;
 	union {
@@ -676,16 +804,32 @@ struct outputstate {
 		u32_t start_at;
 	};
 	unsigned next_sample_rate; // set in decode thread
-	u8_t  *track_start;        // set in decode thread
+	struct marker markers[OUTPUT_MARKERS]; // queued by decode thread, consumed by output thread from marker_head
+	unsigned marker_head;
+	unsigned marker_count;
+	u8_t  frame_bytes;         // bytes per frame in outputbuf for the playing track
+	u8_t  next_frame_bytes;    // set in decode thread - bytes per frame in outputbuf for the track being decoded
+	u8_t  prev_frame_bytes;    // set in decode thread - bytes per frame in outputbuf for the previous decoded track
+	bool  narrow;              // set in output init - write_cb can play NARROW_BYTES_PER_FRAME frames from outputbuf
+	unsigned history_size;     // set in output init - bytes of played audio kept in outputbuf for rewinds, 0 if none
+	unsigned history;          // bytes of the playing track played since it started, up to history_size
+	frames_t tail_frames;      // frames last written to the output of one kind, which an output may rewind from its device
+	bool  tail_drop;           // tail_frames are silence or flushed audio which may be dropped, else audio replayed from history
 	u32_t gainL;               // set by slimproto
 	u32_t gainR;               // set by slimproto
 	bool  invert;              // set by slimproto
+	s32_t ramp_gainL;          // volume reached ramping towards gainL
+	s32_t ramp_gainR;          // volume reached ramping towards gainR
+	frames_t ramp_frames;      // frames until ramp_gainL/R reach gainL/R
 	u32_t next_replay_gain;    // set by slimproto
 	unsigned threshold;        // set by slimproto
 	fade_state fade;
 	u8_t *fade_start;
 	u8_t *fade_end;
 	fade_dir fade_dir;
+	fade_mode current_fade_mode; // mode of the fade in progress
+	u32_t cross_replay_gain;   // replay gain of the track faded in by a crossfade in progress
+	u8_t  cross_frame_bytes;   // bytes per frame in outputbuf of the track faded in by a crossfade in progress
 	fade_mode fade_mode;       // set by slimproto
 	unsigned fade_secs;        // set by slimproto
 	unsigned rate_delay;
@@ -700,13 +844,22 @@ struct outputstate {
 #endif
 };
 
+bool output_fade_curve_set(const char *curve);
 void output_init_common(log_level level, const char *device, unsigned output_buf_size, unsigned rates[], unsigned idle);
 void output_close_common(void);
 void output_flush(void);
+void wake_output(void);
+size_t output_release(void);
+void output_reacquire(void);
 bool output_flush_streaming(void);
 // _* called with mutex locked
 frames_t _output_frames(frames_t avail);
 void _checkfade(bool);
+void _output_track_start(u8_t *pos);
+void _output_seal(void);
+frames_t _output_history(void);
+bool _output_rewind(frames_t frames);
+unsigned output_space(void);
 
 // output_alsa.c
 #if ALSA
@@ -714,6 +867,7 @@ void list_devices(void);
 void list_mixers(const char *output_device);
 void set_volume(unsigned left, unsigned right);
 bool test_open(const char *device, unsigned rates[], bool userdef_rates);
+bool alsa_add_device(const char *arg);
 void output_init_alsa(log_level level, const char *device, unsigned output_buf_size, char *params, unsigned rates[], unsigned rate_delay, unsigned rt_priority, unsigned idle, char *mixer_device, char *volume_mixer, bool mixer_unmute, bool mixer_linear);
 void output_close_alsa(void);
 #endif
@@ -744,11 +898,28 @@ void output_close_stdout(void);
 
 // output_pack.c
 void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format);
-void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr);
-void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags);
+void _scale_and_pack_frames16(void *outputptr, s16_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format,
+							  const struct gain_ramp *ramp);
+void _apply_cross(struct buffer *outputbuf, frames_t out_frames, struct cross_mix *cross, const struct gain_ramp *ramp);
+void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags, const struct gain_ramp *ramp);
+void _scale_and_pack_fused(struct pack_spec *spec, void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR,
+						   struct buffer *outputbuf, struct cross_mix *cross, const struct gain_ramp *ramp);
+bool _pack_select(struct pack_spec *spec, output_format format, u8_t flags, bool unity);
+bool pack_dither_set(const char *type);
 s32_t gain(s32_t gain, s32_t sample);
 s32_t to_gain(float f);
 
+// output_pack_simd.c
+#if PACK_SIMD
+const char *pack_simd_init(const char *isa);
+frames_t _scale_and_pack_simd(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, output_format format, bool unity);
+frames_t _apply_gain_simd(s32_t *ptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags);
+frames_t _apply_cross_simd(s32_t *optr, s32_t *iptr, s32_t *cross_ptr, frames_t cnt, s32_t cross_gain_in, s32_t cross_gain_out);
+frames_t _gain_ramp_simd(s32_t *optr, s32_t *iptr, frames_t cnt, s32_t accL, s32_t accR, s32_t stepL, s32_t stepR);
+frames_t _cross_ramp_simd(s32_t *optr, s32_t *iptr, s32_t *cross_ptr, frames_t cnt, s32_t acc_in, s32_t acc_out, s32_t step_in, s32_t step_out);
+frames_t _dither_simd(s32_t *optr, s32_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR, s32_t mask, u32_t seed[8]);
+#endif
+
 // output_vis.c
 #if VISEXPORT
 void _vis_export(struct buffer *outputbuf, struct outputstate *output, frames_t out_frames, bool silence);
@@ -759,6 +930,28 @@ void vis_stop(void);
 #define vis_stop()
 #endif
 
+// output_zbuf.c
+#if LINUX && !SUN
+bool zbuf_init(log_level level, struct buffer *buf, size_t size);
+void zbuf_close(void);
+void zbuf_written(u8_t *from, u8_t width);
+void zbuf_pack(void);
+unsigned zbuf_space(unsigned space);
+// _* called with mutex locked
+void _zbuf_stage(u8_t *p, size_t bytes);
+void _zbuf_flush(void);
+void _zbuf_discard(u8_t *from);
+#else
+#define zbuf_init(...) false
+#define zbuf_close()
+#define zbuf_written(...)
+#define zbuf_pack()
+#define zbuf_space(space) (space)
+#define _zbuf_stage(...)
+#define _zbuf_flush()
+#define _zbuf_discard(...)
+#endif
+
 // dop.c
 #if DSD
 bool is_stream_dop(u8_t *lptr, u8_t *rptr, int step, frames_t frames);
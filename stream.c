@@ -87,6 +87,18 @@ static log_level loglevel;
 static struct buffer buf;
 struct buffer *streambuf = &buf;
 
+// streambuf sized in seconds of audio at the stream's bitrate rather than in bytes, set from command line
+unsigned streambuf_secs = 0;
+static size_t streambuf_sized;
+
+// directory for a file backed streambuf, set from command line
+const char *streambuf_dir = NULL;
+
+#define DEFAULT_BITRATE 1411 // kbps of cd pcm, used before a codec is known
+
+// kbps streambuf is sized for, the codec's nominal bitrate until the codec sets it from the stream's parameters
+static volatile unsigned stream_kbps = DEFAULT_BITRATE;
+
 #define LOCK   mutex_lock(streambuf->mutex)
 #define UNLOCK mutex_unlock(streambuf->mutex)
 
@@ -510,7 +522,49 @@ static void stream_ogg(size_t n) {
 }
 #endif
 
+// called with mutex locked at the start of a stream once the buffer has been flushed and the codec opened, and from
+// the stream thread if the codec raises the bitrate once the stream's parameters are known, when the buffer only grows
+static void _stream_resize(bool start) {
+	unsigned kbps = stream_kbps;
+	size_t size;
+
+	if (!streambuf_secs) {
+		return;
+	}
+
+	size = max((size_t)streambuf_secs * kbps * 1000 / 8, STREAMBUF_SIZE_MIN);
+	if (size == streambuf_sized || (!start && size < streambuf_sized)) {
+		return;
+	}
+
+	if (_buf_resize(streambuf, size)) {
+		// keep the wrap at a whole number of frames for any pcm size and channels, as buf_adjust set it at codec open
+		size_t frames = streambuf->size - streambuf->size % 24;
+		if (!(streambuf->mem & BUF_MIRROR) && frames > _buf_used(streambuf)) {
+			streambuf->size = frames;
+			streambuf->wrap = streambuf->buf + frames;
+		}
+		LOG_INFO("streambuf: %u bytes at %p" BUF_MEM_FMT " for %u seconds at %u kbps", streambuf->size, streambuf->buf,
+				 BUF_MEM_ARGS(streambuf->mem), streambuf_secs, kbps);
+	} else {
+		LOG_WARN("unable to resize streambuf, keeping %u bytes", streambuf->size);
+	}
+	streambuf_sized = size;
+}
+
+// called by the codec with the stream's bitrate, or an upper bound on it, the streambuf is resized when next sized or
+// grown straight away if already streaming
+void stream_bitrate(unsigned kbps) {
+	stream_kbps = kbps;
+}
+
 static void *stream_thread(void *vargp) {
+#if LINUX && !SUN
+	void *stack;
+	size_t stack_size;
+	bool stack_locked = lock_thread_stack(&stack, &stack_size);
+	LOG_INFO("stream thread stack: %u bytes at %p%s", stack_size, stack, stack_locked ? " locked" : " not locked");
+#endif
 	while (running) {
 
 		struct pollfd pollinfo;
@@ -518,6 +572,10 @@ static void *stream_thread(void *vargp) {
 
 		LOCK;
 
+		if ((size_t)streambuf_secs * stream_kbps * 1000 / 8 > streambuf_sized) {
+			_stream_resize(false);
+		}
+
 		space = min(_buf_space(streambuf), _buf_cont_write(streambuf));
 
 		if (fd < 0 || !space || stream.state <= STREAMING_WAIT) {
@@ -756,13 +814,23 @@ void stream_init(log_level level, unsigned stream_buf_size) {
 	loglevel = level;
 
 	LOG_INFO("init stream");
+	if (streambuf_secs) {
+		// resized for each stream once the codec is known
+		stream_buf_size = max(streambuf_secs * DEFAULT_BITRATE * 1000 / 8, STREAMBUF_SIZE_MIN);
+		streambuf_sized = stream_buf_size;
+	}
+
 	LOG_DEBUG("streambuf size: %u", stream_buf_size);
 
-	buf_init(streambuf, stream_buf_size);
+	buf_init_file(streambuf, stream_buf_size, streambuf_dir);
 	if (streambuf->buf == NULL) {
 		LOG_ERROR("unable to malloc buffer");
 		exit(1);
 	}
+	if (streambuf_dir && !(streambuf->mem & BUF_FILE)) {
+		LOG_WARN("unable to create streambuf file in %s, using memory", streambuf_dir);
+	}
+	LOG_INFO("streambuf: %u bytes at %p" BUF_MEM_FMT, streambuf->size, streambuf->buf, BUF_MEM_ARGS(streambuf->mem));
 
 #if USE_LIBOGG && !LINKALL
 	ogg.dl.handle = dlopen(LIBOGG, RTLD_NOW);
@@ -809,10 +877,6 @@ void stream_init(log_level level, unsigned stream_buf_size) {
 
 	fd = -1;
 
-#if LINUX || FREEBSD
-	touch_memory(streambuf->buf, streambuf->size);
-#endif
-
 #if LINUX || OSX || FREEBSD
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
@@ -844,6 +908,8 @@ void stream_file(const char *header, size_t header_len, unsigned threshold) {
 
 	LOCK;
 
+	_stream_resize(true);
+
 	stream.header_len = header_len;
 	memcpy(stream.header, header, header_len);
 	*(stream.header+header_len) = '\0';
@@ -909,6 +975,8 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char* h
 
 	LOCK;
 
+	_stream_resize(true);
+
 	fd = sock;
 	stream.state = SEND_HEADERS;
 	stream.cont_wait = cont_wait;
@@ -947,6 +1015,23 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char* h
 	UNLOCK;
 }
 
+// release streambuf memory while no stream is connected and it is empty
+size_t stream_release(void) {
+	size_t bytes = 0;
+	LOCK;
+	if (stream.state <= DISCONNECT && !_buf_used(streambuf)) {
+		bytes = _buf_release(streambuf);
+	}
+	UNLOCK;
+	return bytes;
+}
+
+void stream_reacquire(void) {
+	LOCK;
+	_buf_reacquire(streambuf);
+	UNLOCK;
+}
+
 bool stream_disconnect(void) {
 	bool disc = false;
 	LOCK;
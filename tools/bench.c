@@ -0,0 +1,361 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2015, triode1@btinternet.com
+ *      Ralph Irving 2015-2025, ralph_irving@hotmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Microbenchmarks of the buffer.c and output_pack.c hot paths, built and run by: make bench [BENCH_MS=<ms per case>]
+// Results are written to stdout as json, one entry per case with frames/sec and cycles/frame, the latter null where
+// cpu cycles can't be counted (no perf events, e.g. in a container or with perf_event_paranoid set)
+
+#include "squeezelite.h"
+
+#if LINUX
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TSC 1
+#else
+#define TSC 0
+#endif
+
+#define FRAMES    4096              // frames per call, period sized and held in cache
+#define RING      (64 * 1024)       // ring buffer bytes, wrapping benchmarks move odd sized chunks through it
+
+#if LINUX
+extern bool buf_mirror;
+#endif
+
+static unsigned bench_ms = 200;
+static int cycles_fd = -1;
+static const char *cycles_source;  // perf cpu cycles, else the x86 time stamp counter, else none
+static bool first = true;
+static const char *isa;
+
+static u8_t out[FRAMES * 8];
+static s32_t in[FRAMES * 2];
+static s16_t in16[FRAMES * 2];
+
+static u64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void cycles_open(void) {
+#if LINUX
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (cycles_fd >= 0) {
+		cycles_source = "perf";
+		return;
+	}
+#endif
+#if TSC
+	// reference cycles at the nominal clock rather than core cycles, but comparable between runs on one machine
+	cycles_source = "tsc";
+#endif
+}
+
+static u64_t cycles(void) {
+	u64_t c = 0;
+	if (cycles_fd >= 0) {
+		if (read(cycles_fd, &c, sizeof(c)) != sizeof(c)) {
+			c = 0;
+		}
+	}
+#if TSC
+	else {
+		c = __rdtsc();
+	}
+#endif
+	return c;
+}
+
+static void fill(void) {
+	unsigned i;
+	for (i = 0; i < FRAMES * 2; ++i) {
+		in[i] = (s32_t)((i * 2654435761u) ^ (i << 7)) & ~0xff;
+		in16[i] = (s16_t)(in[i] >> 16);
+	}
+}
+
+struct result {
+	u64_t frames, ns, cycles;
+};
+
+static void report(const char *name, const char *format, const char *gain, const char *mono, struct result *r) {
+	double secs = r->ns / 1e9;
+	printf("%s\n    {\"name\": \"%s\"", first ? "" : ",", name);
+	if (isa) printf(", \"isa\": \"%s\"", isa);
+	if (format) printf(", \"format\": \"%s\"", format);
+	if (gain) printf(", \"gain\": \"%s\"", gain);
+	if (mono) printf(", \"mono\": \"%s\"", mono);
+	printf(", \"frames_per_sec\": %.0f, \"ns_per_frame\": %.3f, \"cycles_per_frame\": ", r->frames / secs,
+		   (double)r->ns / r->frames);
+	if (r->cycles) {
+		printf("%.3f}", (double)r->cycles / r->frames);
+	} else {
+		printf("null}");
+	}
+	first = false;
+	fflush(stdout);
+}
+
+// a case which does no work, listed so the results cover every combination
+static void report_skipped(const char *name, const char *gain, const char *mono, const char *reason) {
+	printf("%s\n    {\"name\": \"%s\"", first ? "" : ",", name);
+	if (gain) printf(", \"gain\": \"%s\"", gain);
+	if (mono) printf(", \"mono\": \"%s\"", mono);
+	printf(", \"skipped\": \"%s\"}", reason);
+	first = false;
+	fflush(stdout);
+}
+
+// repeat call until bench_ms has elapsed, call returns the frames it processed
+#define RUN(r, call) do {								\
+	u64_t _end, _c0, _t0;								\
+	call; /* warm up */									\
+	_c0 = cycles(); _t0 = now_ns(); _end = _t0 + (u64_t)bench_ms * 1000000; \
+	(r).frames = 0;										\
+	do {												\
+		unsigned _i;									\
+		for (_i = 0; _i < 16; ++_i) (r).frames += call;	\
+		(r).ns = now_ns() - _t0;						\
+	} while (_t0 + (r).ns < _end);						\
+	(r).cycles = cycles_source ? cycles() - _c0 : 0;	\
+} while (0)
+
+static const struct { output_format format; const char *name; } formats[] = {
+	{ S32_LE, "S32_LE" }, { S24_LE, "S24_LE" }, { S24_3LE, "S24_3LE" }, { S16_LE, "S16_LE" }, { FLOAT_LE, "FLOAT_LE" },
+#if DSD
+	{ U8, "U8" }, { U16_LE, "U16_LE" }, { U16_BE, "U16_BE" }, { U32_LE, "U32_LE" }, { U32_BE, "U32_BE" },
+#endif
+};
+
+static const struct { u8_t flags; const char *name; } monos[] = {
+	{ 0, "none" }, { MONO_LEFT, "left" }, { MONO_RIGHT, "right" }, { MONO_LEFT | MONO_RIGHT, "both" },
+};
+
+static const struct { s32_t gainL, gainR; const char *name; } gains[] = {
+	{ FIXED_ONE, FIXED_ONE, "unity" }, { FIXED_ONE / 3, FIXED_ONE / 2, "scaled" },
+};
+
+static const struct { const char *type, *name; } dithers[] = {
+	{ "tpdf", "scale_and_pack_tpdf" }, { "shaped1", "scale_and_pack_shaped1" },
+	{ "shaped2", "scale_and_pack_shaped2" }, { "lipshitz", "scale_and_pack_lipshitz" },
+};
+
+#if PACK_SIMD
+static const char *isas[] = { "scalar", "sse2", "avx2", "neon" };
+#endif
+
+static frames_t pack(output_format format, s32_t gainL, s32_t gainR, u8_t flags) {
+	_scale_and_pack_frames(out, in, FRAMES, gainL, gainR, flags, format);
+	return FRAMES;
+}
+
+static frames_t pack16(output_format format, s32_t gainL, s32_t gainR, u8_t flags) {
+	_scale_and_pack_frames16(out, in16, FRAMES, gainL, gainR, flags, format, NULL);
+	return FRAMES;
+}
+
+static frames_t apply_gain(struct buffer *b, s32_t gainL, s32_t gainR, u8_t flags) {
+	_apply_gain(b, FRAMES, gainL, gainR, flags, NULL);
+	return FRAMES;
+}
+
+static frames_t apply_cross(struct buffer *b) {
+	static struct cross_mix cross = { FIXED_ONE / 3, FIXED_ONE - FIXED_ONE / 3, NULL, BYTES_PER_FRAME, BYTES_PER_FRAME };
+	// cross.ptr walks round the buffer wrapping as it would through the new track
+	if (!cross.ptr) {
+		cross.ptr = b->buf;
+	}
+	_apply_cross(b, FRAMES, &cross, NULL);
+	return FRAMES;
+}
+
+// crossfade mix and pack in one pass from a buffer, the new track walking round it as in apply_cross, gains ramped per
+// frame if ramp is set as through a fade. Both tracks are stored as frames of frame_bytes.
+static frames_t pack_cross(struct buffer *b, output_format format, const struct gain_ramp *ramp, u8_t frame_bytes) {
+	static struct cross_mix cross = { FIXED_ONE / 3, FIXED_ONE - FIXED_ONE / 3, NULL, 0, 0 };
+	struct pack_spec spec = { NULL };
+	if (!cross.ptr) {
+		cross.ptr = b->buf;
+	}
+	cross.in_bytes = cross.out_bytes = frame_bytes;
+	_pack_select(&spec, format, 0, false);
+	_scale_and_pack_fused(&spec, out, (s32_t *)(void *)b->readp, FRAMES, FIXED_ONE / 2, FIXED_ONE / 2, b, &cross, ramp);
+	return FRAMES;
+}
+
+// move chunks of an awkward size through a ring buffer as decode and output do, splitting at wrap unless mirrored
+static frames_t ring(struct buffer *b) {
+	static const unsigned chunk = 1153 * BYTES_PER_FRAME;
+	unsigned bytes = chunk;
+	while (bytes) {
+		unsigned n = min(bytes, min(_buf_space(b), _buf_cont_write(b)));
+		memcpy(b->writep, out, n);
+		_buf_inc_writep(b, n);
+		bytes -= n;
+	}
+	bytes = chunk;
+	while (bytes) {
+		unsigned n = min(bytes, _buf_cont_read(b));
+		memcpy(out, b->readp, n);
+		_buf_inc_readp(b, n);
+		bytes -= n;
+	}
+	return chunk / BYTES_PER_FRAME;
+}
+
+// unwrap a nearly full ring where the data wraps, as codecs do before parsing a frame straddling the end
+static frames_t unwrap(struct buffer *b) {
+	unsigned cont = FRAMES * BYTES_PER_FRAME;
+	b->readp = b->wrap - cont / 3;
+	b->writep = b->readp - cont / 4;
+	_buf_unwrap(b, cont);
+	return cont / BYTES_PER_FRAME;
+}
+
+int main(int argc, char **argv) {
+	struct buffer buf, *b = &buf;
+	struct result r;
+	unsigned f, g, m, i = 0;
+
+	if (argc > 1) {
+		bench_ms = atoi(argv[1]);
+	}
+
+	cycles_open();
+	fill();
+
+	printf("{\n  \"arch\": \"%s\",\n  \"bytes_per_frame\": %u,\n  \"frames_per_call\": %u,\n  \"cycles\": %s,\n  \"results\": [",
+#if defined(__x86_64__)
+		   "x86_64",
+#elif defined(__aarch64__)
+		   "aarch64",
+#elif defined(__arm__)
+		   "arm",
+#elif defined(__i386__)
+		   "i386",
+#else
+		   "other",
+#endif
+		   BYTES_PER_FRAME, FRAMES, !cycles_source ? "null" : cycles_fd >= 0 ? "\"perf\"" : "\"tsc\"");
+
+	// pack cases are run with each set of kernels the cpu supports
+	do {
+#if PACK_SIMD
+		if (!(isa = pack_simd_init(isas[i]))) continue;
+#endif
+		for (f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			for (g = 0; g < sizeof(gains) / sizeof(gains[0]); ++g) {
+				for (m = 0; m < sizeof(monos) / sizeof(monos[0]); ++m) {
+					RUN(r, pack(formats[f].format, gains[g].gainL, gains[g].gainR, monos[m].flags));
+					report("scale_and_pack", formats[f].name, gains[g].name, monos[m].name, &r);
+					RUN(r, pack16(formats[f].format, gains[g].gainL, gains[g].gainR, monos[m].flags));
+					report("scale_and_pack16", formats[f].name, gains[g].name, monos[m].name, &r);
+				}
+			}
+		}
+#if PACK_SIMD
+	} while (++i < sizeof(isas) / sizeof(isas[0]));
+	pack_simd_init(NULL);
+#else
+	} while (0);
+#endif
+	isa = NULL;
+
+	// requantised with each dither type where it applies
+	for (f = S24_LE; f <= S16_LE; ++f) {
+		for (i = 0; i < sizeof(dithers) / sizeof(dithers[0]); ++i) {
+			pack_dither_set(dithers[i].type);
+			RUN(r, pack(formats[f].format, gains[1].gainL, gains[1].gainR, 0));
+			report(dithers[i].name, formats[f].name, gains[1].name, NULL, &r);
+		}
+	}
+	pack_dither_set("none");
+
+	buf_init(b, FRAMES * BYTES_PER_FRAME * 4);
+	memcpy(b->buf, in, sizeof(in));
+
+	for (g = 0; g < sizeof(gains) / sizeof(gains[0]); ++g) {
+		for (m = 0; m < sizeof(monos) / sizeof(monos[0]); ++m) {
+			if (gains[g].gainL == FIXED_ONE && gains[g].gainR == FIXED_ONE && !monos[m].flags) {
+				// _apply_gain returns at once
+				report_skipped("apply_gain", gains[g].name, monos[m].name, "no-op");
+				continue;
+			}
+			RUN(r, apply_gain(b, gains[g].gainL, gains[g].gainR, monos[m].flags));
+			report("apply_gain", NULL, gains[g].name, monos[m].name, &r);
+		}
+	}
+
+	RUN(r, apply_cross(b));
+	report("apply_cross", NULL, NULL, NULL, &r);
+
+	for (f = 0; f <= FLOAT_LE; ++f) {
+		static const struct gain_ramp ramp = { -5, -7, 3, -3 };
+		RUN(r, pack_cross(b, formats[f].format, NULL, BYTES_PER_FRAME));
+		report("scale_and_pack_fused_cross", formats[f].name, "scaled", NULL, &r);
+		RUN(r, pack_cross(b, formats[f].format, &ramp, BYTES_PER_FRAME));
+		report("scale_and_pack_fused_cross", formats[f].name, "ramped", NULL, &r);
+		RUN(r, pack_cross(b, formats[f].format, NULL, NARROW_BYTES_PER_FRAME));
+		report("scale_and_pack_fused_cross16", formats[f].name, "scaled", NULL, &r);
+	}
+
+	buf_destroy(b);
+
+	buf_init(b, RING);
+	RUN(r, ring(b));
+	report("ring", NULL, NULL, NULL, &r);
+	buf_destroy(b);
+
+#if LINUX
+	buf_mirror = true;
+	buf_init(b, RING);
+	if (b->mem & BUF_MIRROR) {
+		RUN(r, ring(b));
+		report("ring_mirrored", NULL, NULL, NULL, &r);
+	}
+	buf_destroy(b);
+	buf_mirror = false;
+#endif
+
+	buf_init(b, RING);
+	RUN(r, unwrap(b));
+	report("buf_unwrap", NULL, NULL, NULL, &r);
+	buf_destroy(b);
+
+	printf("\n  ]\n}\n");
+
+	if (cycles_fd >= 0) {
+		close(cycles_fd);
+	}
+
+	return 0;
+}
@@ -19,6 +19,8 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include "squeezelite.h"
 
 #if LINUX || OSX || FREEBSD
@@ -57,6 +59,9 @@
 #endif
 
 #include <fcntl.h>
+#if LINUX && !SUN
+#include <sys/mman.h>
+#endif
 
 // logging functions
 const char *logtime(void) {
@@ -120,6 +125,27 @@ u32_t gettime_ms(void) {
 #endif
 }
 
+// same clock as gettime_ms at us resolution, so (u32_t)(gettime_us() / 1000) matches gettime_ms()
+u64_t gettime_us(void) {
+#if WIN
+	return (u64_t)GetTickCount() * 1000;
+#else
+#if LINUX || FREEBSD
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts)) {
+#else
+	if (!clock_gettime(CLOCK_REALTIME, &ts)) {
+#endif
+		return (u64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+#endif
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (u64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
 // mac address
 #if LINUX && !defined(SUN)
 // search first 4 interfaces returned by IFCONF
@@ -499,6 +525,23 @@ void touch_memory(u8_t *buf, size_t size) {
 }
 #endif
 
+#if LINUX && !SUN
+// lock the calling thread's stack so it does not page fault, addr and size are set if the stack could be found
+bool lock_thread_stack(void **addr, size_t *size) {
+	pthread_attr_t attr;
+	bool locked = false;
+	*addr = NULL;
+	*size = 0;
+	if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+		if (pthread_attr_getstack(&attr, addr, size) == 0) {
+			locked = mlock(*addr, *size) == 0;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	return locked;
+}
+#endif
+
 #if WIN || SUN
 char *strcasestr(const char *haystack, const char *needle) {
 	size_t length_needle;
@@ -84,17 +84,9 @@ extern struct processstate process;
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
-#define LOCK_O_direct   if (decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct if (decode.direct) mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct   if (!decode.direct) mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_not_direct if (!decode.direct) mutex_unlock(outputbuf->mutex)
 #define IF_DIRECT(x)    if (decode.direct) { x }
 #define IF_PROCESS(x)   if (!decode.direct) { x }
 #else
-#define LOCK_O_direct   mutex_lock(outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(outputbuf->mutex)
-#define LOCK_O_not_direct
-#define UNLOCK_O_not_direct
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -168,7 +160,7 @@ static decode_state vorbis_decode(void) {
 		LOCK_O;
 		output.next_sample_rate = decode_newstream(info->rate, output.supported_rates);
 		IF_DSD(	output.next_fmt = PCM; )
-		output.track_start = outputbuf->writep;
+		_output_track_start(outputbuf->writep);
 		if (output.fade_mode) _checkfade(true);
 		decode.new_stream = false;
 		UNLOCK_O;
@@ -188,7 +180,6 @@ static decode_state vorbis_decode(void) {
 		write_buf = v->write_buf;
 	);
 #else
-	LOCK_O_direct;
 	IF_DIRECT(
 		frames = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
 		write_buf = outputbuf->writep;
@@ -218,10 +209,6 @@ static decode_state vorbis_decode(void) {
 	}
 #endif	
 
-#if FRAME_BUF
-	LOCK_O_direct;
-#endif	
-
 	if (n > 0) {
 		frames_t count;
 		s16_t *iptr;
@@ -272,7 +259,6 @@ static decode_state vorbis_decode(void) {
 
 		if (stream.state <= DISCONNECT) {
 			LOG_INFO("end of decode");
-			UNLOCK_O_direct;
 			return DECODE_COMPLETE;
 		} else {
 			LOG_INFO("no frame decoded");
@@ -286,11 +272,9 @@ static decode_state vorbis_decode(void) {
 	} else {
 
 		LOG_INFO("ov_read error: %d", n);
-		UNLOCK_O_direct;
 		return DECODE_COMPLETE;
 	}
 
-	UNLOCK_O_direct;
 	return DECODE_RUNNING;
 }
 
@@ -361,6 +345,7 @@ struct codec *register_vorbis(void) {
 		vorbis_open,  // open
 		vorbis_close, // close
 		vorbis_decode,// decode
+		500,          // bitrate kbps
 	};
 
 	v = malloc(sizeof(struct vorbis));